@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "audio_alert.hpp"
+#include "timer_wheel.hpp"
+
+// Drives the bad-posture beeps from a timer wheel on its own thread. The detection side only
+// stores the capture time of the latest good posture sample (one atomic store per frame); when
+// the alert deadline expires, the scheduler checks that time and either beeps or moves the
+// deadline back, so a corrected posture cancels the alert without the detection thread touching
+// the wheel. A good sample only ever moves the deadline later, so the thread sleeps until the
+// wheel's next event and is woken early only when an alert time is changed. One scheduler can
+// serve the alerts of several checkers (streams, seats) with one timer each, on a single thread.
+class AlertScheduler {
+  private:
+    struct Alert {
+      std::atomic<int64_t> last_OK_ns{0}; // since start_time
+      std::atomic<double> alert_time{10.0};
+      std::atomic<bool> alert_time_changed{false};
+      AudioAlert* audio = NULL;
+    };
+
+    struct BeepLevel {
+      double below_countdown; // level applies once the countdown drops below this
+      double period; // seconds between beeps
+    };
+
+    // Bad posture for a short amount of time (0-30s), beep every 10 s; for a medium time (30-60s),
+    // every 5 s; for a long time (60+s), every second
+    static constexpr int NUM_BEEP_LEVELS = 3;
+    static constexpr BeepLevel BEEP_LEVELS[NUM_BEEP_LEVELS] = { {0.0, 10.0}, {-30.0, 5.0}, {-60.0, 1.0} };
+
+    static constexpr int64_t TICK_NS = 10000000; // 10 ms resolution
+
+    std::deque<Alert> alerts; // the timer index is the position; added before start()
+    TimerWheel<> wheel{0};
+    std::chrono::steady_clock::time_point start_time;
+
+    std::thread scheduler_thread;
+    std::atomic<bool> running{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    bool alert_time_changed = false;
+
+    int64_t nowNs(){
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    // Rounded up, so that a timer never fires before its deadline
+    void scheduleAt(int id, int64_t deadline_ns){
+      wheel.schedule(id, (uint64_t)((deadline_ns + TICK_NS - 1) / TICK_NS));
+    }
+
+    void scheduleCountdown(int id){
+      Alert& alert = alerts[id];
+      scheduleAt(id, alert.last_OK_ns.load(std::memory_order_relaxed) + (int64_t)(alert.alert_time * 1e9));
+    }
+
+    void onAlertTimer(int id){
+      Alert& alert = alerts[id];
+      int64_t now = nowNs();
+      int64_t last_OK = alert.last_OK_ns.load(std::memory_order_relaxed);
+      double countdown = alert.alert_time - (now - last_OK) / 1e9;
+
+      if (countdown > 0){
+        // Posture was good since the deadline was set, so the countdown starts over
+        scheduleCountdown(id);
+        return;
+      }
+
+      if (alert.audio){
+        alert.audio->play(getBeepLevel(countdown));
+      }
+      else {
+        std::cout << "\a" << std::flush;
+      }
+      scheduleAt(id, now + (int64_t)(getSecondsUntilNextBeep(countdown) * 1e9));
+    }
+
+    void run(){
+      while (running){
+        bool reschedule;
+        {
+          std::unique_lock<std::mutex> lock(wake_mutex);
+          uint64_t next_tick = wheel.getNextEventTick();
+          auto woken = [this]{ return !running || alert_time_changed; };
+          if (next_tick == UINT64_MAX){
+            wake.wait(lock, woken);
+          }
+          else {
+            wake.wait_until(lock, start_time + std::chrono::nanoseconds((int64_t)next_tick * TICK_NS), woken);
+          }
+          reschedule = alert_time_changed;
+          alert_time_changed = false;
+        }
+        for (int id = 0; reschedule && id < (int)alerts.size(); id++){
+          // The deadline may now be earlier; if it has passed, the alert fires on the next tick
+          if (alerts[id].alert_time_changed.exchange(false)){
+            scheduleCountdown(id);
+          }
+        }
+        wheel.advance((uint64_t)(nowNs() / TICK_NS), [this](int id){ onAlertTimer(id); });
+      }
+    }
+
+  public:
+    ~AlertScheduler(){
+      stop();
+    }
+
+    // Escalation level for a countdown, from 0 up to NUM_BEEP_LEVELS - 1 for the most urgent
+    static int getBeepLevel(double countdown){
+      for (int level = NUM_BEEP_LEVELS - 1; level > 0; level--){
+        if (countdown < BEEP_LEVELS[level].below_countdown){
+          return level;
+        }
+      }
+      return 0;
+    }
+
+    static double getBeepPeriod(double countdown){
+      return BEEP_LEVELS[getBeepLevel(countdown)].period;
+    }
+
+    // Exact delay from a beep at countdown until the next one, including switching to a shorter
+    // period when the countdown crosses into the next level before the current period is over
+    static double getSecondsUntilNextBeep(double countdown){
+      for (int level = 0; level < NUM_BEEP_LEVELS; level++){
+        double enters_level = level == 0 ? 0.0 : countdown - BEEP_LEVELS[level].below_countdown;
+        double delay = std::max(BEEP_LEVELS[level].period, enters_level);
+        bool last_level = level == NUM_BEEP_LEVELS - 1;
+        if (last_level || delay <= countdown - BEEP_LEVELS[level + 1].below_countdown){
+          return delay;
+        }
+      }
+      return BEEP_LEVELS[NUM_BEEP_LEVELS - 1].period;
+    }
+
+    // Before start(): adds an alert and returns its id. Beeps go to the terminal bell if audio is NULL.
+    int addAlert(AudioAlert* audio){
+      alerts.emplace_back();
+      alerts.back().audio = audio;
+      return (int)alerts.size() - 1;
+    }
+
+    void setAlertTime(int id, double seconds){
+      alerts[id].alert_time = seconds;
+      {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        alerts[id].alert_time_changed = running.load();
+        alert_time_changed |= running.load();
+      }
+      wake.notify_all();
+    }
+
+    // Called for every good posture sample with its capture time; this is the only per-frame cost
+    void markPostureOK(int id, std::chrono::steady_clock::time_point timestamp){
+      alerts[id].last_OK_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - start_time).count(), std::memory_order_relaxed);
+    }
+
+    bool isRunning(){
+      return running;
+    }
+
+    // Every alert's countdown starts now
+    void start(){
+      start_time = std::chrono::steady_clock::now();
+      wheel = TimerWheel<>((int)alerts.size());
+      for (int id = 0; id < (int)alerts.size(); id++){
+        alerts[id].last_OK_ns = 0;
+        alerts[id].alert_time_changed = false;
+        scheduleCountdown(id);
+      }
+      running = true;
+      scheduler_thread = std::thread(&AlertScheduler::run, this);
+    }
+
+    void stop(){
+      {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        running = false;
+      }
+      wake.notify_all();
+      if (scheduler_thread.joinable()){
+        scheduler_thread.join();
+      }
+    }
+};
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+using namespace nlohmann;
+
+// Where synthesised alert tones end up. Only ever called from the audio thread.
+class AudioSink {
+  public:
+    virtual ~AudioSink(){}
+    virtual bool open(int sample_rate) = 0;
+    // May block until the device has accepted the samples (mono, 16 bit)
+    virtual void write(const int16_t* samples, size_t num_samples) = 0;
+};
+
+// Discards everything, for running without sound hardware
+class NullSink : public AudioSink {
+  public:
+    bool open(int) override {
+      return true;
+    }
+    void write(const int16_t*, size_t) override {}
+};
+
+// Appends every tone to a WAV file, so alerts can be checked without sound hardware
+class WavFileSink : public AudioSink {
+  private:
+    std::string path;
+    std::ofstream file;
+    int sample_rate = 0;
+    uint32_t data_bytes = 0;
+
+    void writeLE(uint32_t value, int num_bytes){
+      for (int i = 0; i < num_bytes; i++){
+        file.put((char)((value >> (8*i)) & 0xFF));
+      }
+    }
+
+    // RIFF header; rewritten on close once the data size is known
+    void writeHeader(){
+      file.seekp(0);
+      file.write("RIFF", 4);
+      writeLE(36 + data_bytes, 4);
+      file.write("WAVEfmt ", 8);
+      writeLE(16, 4); // fmt chunk size
+      writeLE(1, 2); // PCM
+      writeLE(1, 2); // mono
+      writeLE(sample_rate, 4);
+      writeLE(sample_rate * 2, 4); // byte rate
+      writeLE(2, 2); // block align
+      writeLE(16, 2); // bits per sample
+      file.write("data", 4);
+      writeLE(data_bytes, 4);
+    }
+
+  public:
+    WavFileSink(const std::string& path) : path(path) {}
+
+    ~WavFileSink(){
+      if (file.is_open()){
+        writeHeader();
+      }
+    }
+
+    bool open(int rate) override {
+      sample_rate = rate;
+      file.open(path, std::ios::binary | std::ios::trunc);
+      if (!file.is_open()){
+        return false;
+      }
+      writeHeader();
+      return true;
+    }
+
+    void write(const int16_t* samples, size_t num_samples) override {
+      for (size_t i = 0; i < num_samples; i++){
+        writeLE((uint16_t)samples[i], 2);
+      }
+      data_bytes += num_samples * 2;
+      file.flush();
+    }
+};
+
+#ifdef HAVE_ALSA
+// ALSA playback; on desktops the "default" device usually routes through PulseAudio/PipeWire
+class AlsaSink : public AudioSink {
+  private:
+    std::string device;
+    snd_pcm_t* pcm = NULL;
+
+  public:
+    AlsaSink(const std::string& device) : device(device) {}
+
+    ~AlsaSink(){
+      if (pcm){
+        snd_pcm_drain(pcm);
+        snd_pcm_close(pcm);
+      }
+    }
+
+    bool open(int sample_rate) override {
+      if (snd_pcm_open(&pcm, device.c_str(), SND_PCM_STREAM_PLAYBACK, 0) < 0){
+        pcm = NULL;
+        return false;
+      }
+      // 100 ms of buffering, with automatic resampling if the device needs it
+      return snd_pcm_set_params(pcm, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 1, sample_rate, 1, 100000) == 0;
+    }
+
+    void write(const int16_t* samples, size_t num_samples) override {
+      while (num_samples > 0){
+        snd_pcm_sframes_t written = snd_pcm_writei(pcm, samples, num_samples);
+        if (written < 0){
+          // The stream underruns between alerts; recover and retry
+          if (snd_pcm_recover(pcm, (int)written, 1) < 0){
+            return;
+          }
+          continue;
+        }
+        samples += written;
+        num_samples -= written;
+      }
+    }
+};
+#endif
+
+
+// Plays the posture alert tones without waiting for the sound. All tones are synthesised into
+// preallocated buffers up front. play() stores the tone index under a mutex held only for that
+// store and signals a condition variable; the audio thread sleeps on it and then writes the
+// buffer to the sink outside the lock, without allocating.
+class AudioAlert {
+  public:
+    // One tone per beep level of AlertScheduler, rising in pitch as the alert escalates, and a
+    // lower one for the blink reminder
+    static constexpr int NUM_TONES = 4;
+    static constexpr int FATIGUE_TONE = 3;
+
+  private:
+    static constexpr double TONE_FREQUENCIES[NUM_TONES] = { 880.0, 1174.7, 1568.0, 659.3 };
+    static constexpr double TONE_DURATION = 0.15; // seconds
+    static constexpr double TONE_RAMP = 0.005; // fade in/out to avoid clicks
+
+    std::string sink_type;
+    std::string device;
+    std::string wav_path;
+    int sample_rate;
+
+    std::unique_ptr<AudioSink> sink;
+    std::vector<int16_t> tones[NUM_TONES];
+    std::atomic<int> pending_tone{-1};
+    std::atomic<long> num_played{0};
+
+    std::thread audio_thread;
+    std::atomic<bool> running{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+
+    void synthesizeTones(){
+      size_t num_samples = (size_t)(TONE_DURATION * sample_rate);
+      size_t ramp_samples = (size_t)(TONE_RAMP * sample_rate);
+      for (int tone = 0; tone < NUM_TONES; tone++){
+        tones[tone].resize(num_samples);
+        for (size_t i = 0; i < num_samples; i++){
+          double envelope = 1.0;
+          size_t from_edge = std::min(i, num_samples - 1 - i);
+          if (from_edge < ramp_samples){
+            envelope = 0.5 - 0.5*cos(M_PI * from_edge / ramp_samples);
+          }
+          double sample = 0.3 * envelope * sin(2.0 * M_PI * TONE_FREQUENCIES[tone] * i / sample_rate);
+          tones[tone][i] = (int16_t)(sample * 32767.0);
+        }
+      }
+    }
+
+    void run(){
+      while (running){
+        {
+          std::unique_lock<std::mutex> lock(wake_mutex);
+          wake.wait(lock, [this]{ return pending_tone >= 0 || !running; });
+        }
+
+        int tone = pending_tone.exchange(-1);
+        if (tone >= 0){
+          sink->write(tones[tone].data(), tones[tone].size());
+          num_played++;
+        }
+      }
+    }
+
+  public:
+    // wav_file: write the tones to this WAV file, whatever "sink" settings.json selects
+    AudioAlert(const std::string& wav_file = ""){
+      readJsonSettings("config/settings.json");
+      if (!wav_file.empty()){
+        sink_type = "wav";
+        wav_path = wav_file;
+      }
+      synthesizeTones();
+
+      if (sink_type == "null"){
+        sink.reset(new NullSink());
+      }
+      else if (sink_type == "wav"){
+        sink.reset(new WavFileSink(wav_path));
+      }
+#ifdef HAVE_ALSA
+      else if (sink_type == "alsa"){
+        sink.reset(new AlsaSink(device));
+      }
+#endif
+
+      if (sink && !sink->open(sample_rate)){
+        std::cout << "Could not open audio sink \"" << sink_type << "\", using the terminal bell\n";
+        sink.reset();
+      }
+      else if (!sink && sink_type != "bell"){
+        std::cout << "Audio sink \"" << sink_type << "\" not available, using the terminal bell\n";
+      }
+
+      if (sink){
+        running = true;
+        audio_thread = std::thread(&AudioAlert::run, this);
+      }
+    }
+
+    ~AudioAlert(){
+      {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        running = false;
+      }
+      wake.notify_all();
+      if (audio_thread.joinable()){
+        audio_thread.join();
+      }
+    }
+
+    void readJsonSettings(std::string file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      json audio_settings = settings.value("audio", json::object());
+      sink_type = audio_settings.value("sink", "bell");
+      device = audio_settings.value("device", "default");
+      wav_path = audio_settings.value("wav_path", "alerts.wav");
+      sample_rate = audio_settings.value("sample_rate", 44100);
+    }
+
+    // Safe to call from any thread, never waits for the sound. A tone that has not started yet is replaced.
+    void play(int tone){
+      tone = std::max(0, std::min(tone, NUM_TONES - 1));
+      if (!sink){
+        std::cout << "\a" << std::flush;
+        return;
+      }
+      {
+        // Under the lock, so the audio thread cannot miss it between its check and its wait
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        pending_tone.store(tone);
+      }
+      wake.notify_one();
+    }
+
+    long getNumPlayed(){
+      return num_played;
+    }
+};
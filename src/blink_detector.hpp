@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+
+using namespace nlohmann;
+using namespace cv;
+
+// Counts blinks from a per-frame eye openness score and keeps the blink rate over a sliding
+// window. The score only has to drop when the eyes close: it is compared with a slowly adapting
+// baseline of the open eyes, so the profile and landmark measures below both work. A closure
+// between min_duration and max_duration counts as a blink once the eyes open again; longer ones
+// are eyes kept shut. The window is a ring of one-second bins with running sums, O(1) per frame.
+class BlinkDetector {
+  private:
+    double closed_ratio = 0.6; // closed below this fraction of the baseline
+    double baseline_alpha = 0.02; // per frame with open eyes
+    double min_duration = 0.05; // s
+    double max_duration = 0.5;
+    int window_seconds = 60;
+
+    double baseline = -1.0;
+    bool closed = false;
+    std::chrono::steady_clock::time_point closed_since;
+    long num_blinks = 0;
+
+    std::vector<int> blink_bins; // blinks per second
+    std::vector<char> observed_bins; // seconds with an openness score
+    long current_second = -1;
+    int window_blinks = 0;
+    int window_observed = 0;
+
+    // Moves the window up to timestamp, clearing the seconds that leave it
+    void advance(std::chrono::steady_clock::time_point timestamp){
+      long second = std::chrono::duration_cast<std::chrono::seconds>(timestamp.time_since_epoch()).count();
+      if (current_second < 0 || second - current_second >= window_seconds){
+        std::fill(blink_bins.begin(), blink_bins.end(), 0);
+        std::fill(observed_bins.begin(), observed_bins.end(), 0);
+        window_blinks = 0;
+        window_observed = 0;
+        current_second = second;
+        return;
+      }
+      while (current_second < second){
+        current_second++;
+        int bin = current_second % window_seconds;
+        window_blinks -= blink_bins[bin];
+        window_observed -= observed_bins[bin];
+        blink_bins[bin] = 0;
+        observed_bins[bin] = 0;
+      }
+    }
+
+  public:
+    BlinkDetector(){
+      readSettings(json::object());
+    }
+
+    void readSettings(const json& blink_settings){
+      closed_ratio = blink_settings.value("closed_ratio", 0.6);
+      min_duration = blink_settings.value("min_duration", 0.05);
+      max_duration = blink_settings.value("max_duration", 0.5);
+      int seconds = std::max(1, blink_settings.value("window", 60));
+      if (seconds != window_seconds || blink_bins.empty()){
+        window_seconds = seconds;
+        blink_bins.assign(window_seconds, 0);
+        observed_bins.assign(window_seconds, 0);
+        current_second = -1;
+      }
+    }
+
+    // Fraction of the eye box's rows darker than halfway between its darkest and brightest row.
+    // The iris and pupil make a tall dark band in an open eye, the closed lid a thin one.
+    static double profileOpenness(const Mat& gray, Rect box){
+      box &= Rect(0, 0, gray.cols, gray.rows);
+      // The middle columns, away from the eye corners
+      int x0 = box.x + box.width/5;
+      int x1 = box.x + box.width - box.width/5;
+      if (box.height < 3 || x1 <= x0){
+        return -1.0;
+      }
+      float row_means[256];
+      int rows = std::min(box.height, 256);
+      float darkest = 255.0f, brightest = 0.0f;
+      for (int y = 0; y < rows; y++){
+        const uchar* row = gray.ptr<uchar>(box.y + y);
+        int sum = 0;
+        for (int x = x0; x < x1; x++){
+          sum += row[x];
+        }
+        row_means[y] = (float)sum / (x1 - x0);
+        darkest = std::min(darkest, row_means[y]);
+        brightest = std::max(brightest, row_means[y]);
+      }
+      float threshold = (darkest + brightest) / 2;
+      int dark_rows = 0;
+      for (int y = 0; y < rows; y++){
+        dark_rows += row_means[y] < threshold;
+      }
+      return (double)dark_rows / rows;
+    }
+
+    // Eye aspect ratio (Soukupová & Čech) of the six outline points from first in the 68-point model
+    static double aspectRatio(const std::vector<Point2f>& landmarks, int first){
+      const Point2f* p = &landmarks[first];
+      double width = norm(p[0] - p[3]);
+      if (width <= 0.0){
+        return -1.0;
+      }
+      return (norm(p[1] - p[5]) + norm(p[2] - p[4])) / (2.0 * width);
+    }
+
+    // openness < 0: no score on this frame (no face). Call for every frame.
+    void addOpenness(double openness, std::chrono::steady_clock::time_point timestamp){
+      advance(timestamp);
+      if (openness < 0.0){
+        return;
+      }
+      int bin = current_second % window_seconds;
+      if (!observed_bins[bin]){
+        observed_bins[bin] = 1;
+        window_observed++;
+      }
+
+      if (baseline < 0.0){
+        baseline = openness;
+        return;
+      }
+
+      if (openness < closed_ratio * baseline){
+        if (!closed){
+          closed = true;
+          closed_since = timestamp;
+        }
+        return;
+      }
+
+      if (closed){
+        closed = false;
+        double duration = std::chrono::duration<double>(timestamp - closed_since).count();
+        if (duration >= min_duration && duration <= max_duration){
+          blink_bins[bin]++;
+          window_blinks++;
+          num_blinks++;
+        }
+      }
+      baseline += baseline_alpha * (openness - baseline);
+    }
+
+    long getNumBlinks(){
+      return num_blinks;
+    }
+
+    // Seconds in the window in which the eyes were seen
+    int getObservedSeconds(){
+      return window_observed;
+    }
+
+    int getWindowSeconds(){
+      return window_seconds;
+    }
+
+    // Blinks per minute over the seconds of the window in which the eyes were seen
+    double getBlinkRate(){
+      return window_observed > 0 ? window_blinks * 60.0 / window_observed : 0.0;
+    }
+};
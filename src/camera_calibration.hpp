@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/videoio.hpp"
+#include "opencv2/calib3d.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// Offline camera calibration from a recorded chessboard: a video file, or images matching a glob
+// pattern such as "shots/*.png". Needs no display and no camera. Frames are loaded as grayscale,
+// the chessboard corners are found on all cores (one image per task, claimed through an atomic
+// counter), and calibrateCamera fits fx, fy, cx, cy and the distortion coefficients, which are
+// written into "camera_calibration" in settings.json.
+class CameraCalibrator {
+  private:
+    Size board_size = Size(9, 6); // inner corners
+    double square_size = 0.025; // m
+    int max_images = 60;
+    int num_threads = 0; // 0: one per core
+
+    std::vector<Mat> images;
+    Size image_size;
+    std::vector<std::vector<Point2f>> image_corners;
+    std::vector<char> found; // per image; char, not bool, so threads write separate bytes
+
+    Mat camera_matrix;
+    Mat dist_coeffs;
+    double rms_error = 0.0;
+
+    void addImage(const Mat& image){
+      Mat gray;
+      if (image.channels() == 3){
+        cvtColor(image, gray, COLOR_BGR2GRAY);
+      }
+      else {
+        gray = image;
+      }
+      if (images.empty()){
+        image_size = gray.size();
+      }
+      if (gray.size() != image_size){
+        std::cout << "Skipping an image of another size\n";
+        return;
+      }
+      images.push_back(gray);
+    }
+
+    void findCorners(size_t index){
+      bool board_found = findChessboardCorners(images[index], board_size, image_corners[index],
+                                               CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK);
+      if (board_found){
+        cornerSubPix(images[index], image_corners[index], Size(11, 11), Size(-1, -1),
+                     TermCriteria(TermCriteria::COUNT + TermCriteria::EPS, 30, 0.01));
+      }
+      found[index] = board_found;
+    }
+
+  public:
+    void readSettings(const json& calibration_settings){
+      board_size = Size(calibration_settings.value("board_columns", 9), calibration_settings.value("board_rows", 6));
+      square_size = calibration_settings.value("square_size", 0.025);
+      max_images = calibration_settings.value("max_images", 60);
+      num_threads = calibration_settings.value("threads", 0);
+    }
+
+    // A path containing '*' is an image pattern, anything else a video. At most max_images are
+    // kept, spread evenly over the video.
+    bool load(const std::string& path){
+      images.clear();
+      if (path.find('*') != std::string::npos){
+        std::vector<String> files;
+        glob(path, files);
+        size_t step = std::max<size_t>(1, (files.size() + max_images - 1) / max_images);
+        for (size_t i = 0; i < files.size(); i += step){
+          Mat image = imread(files[i], IMREAD_GRAYSCALE);
+          if (image.empty()){
+            std::cout << "Could not read " << files[i] << "\n";
+            continue;
+          }
+          addImage(image);
+        }
+      }
+      else {
+        VideoCapture video(path);
+        if (!video.isOpened()){
+          std::cout << "Could not open " << path << "\n";
+          return false;
+        }
+        long num_frames = (long)video.get(CAP_PROP_FRAME_COUNT);
+        long step = num_frames > max_images ? num_frames / max_images : 1;
+        Mat frame;
+        for (long i = 0; video.read(frame) && (long)images.size() < max_images; i++){
+          if (i % step == 0){
+            addImage(frame);
+          }
+        }
+      }
+      std::cout << "Loaded " << images.size() << " images of " << image_size.width << "x" << image_size.height << " px\n";
+      return !images.empty();
+    }
+
+    // Finds the corners in all images in parallel; returns the number of images with a board
+    int detectCorners(){
+      image_corners.assign(images.size(), std::vector<Point2f>());
+      found.assign(images.size(), 0);
+
+      int workers = num_threads > 0 ? num_threads : std::max(1u, std::thread::hardware_concurrency());
+      workers = std::min<int>(workers, images.size());
+      std::atomic<size_t> next_image{0};
+      std::vector<std::thread> threads;
+      for (int t = 0; t < workers; t++){
+        threads.emplace_back([this, &next_image]{
+          for (size_t i = next_image++; i < images.size(); i = next_image++){
+            findCorners(i);
+          }
+        });
+      }
+      for (std::thread& thread : threads){
+        thread.join();
+      }
+      return (int)std::count(found.begin(), found.end(), 1);
+    }
+
+    bool calibrate(){
+      std::vector<Point3f> board;
+      for (int y = 0; y < board_size.height; y++){
+        for (int x = 0; x < board_size.width; x++){
+          board.push_back(Point3f(x * square_size, y * square_size, 0.0f));
+        }
+      }
+      std::vector<std::vector<Point3f>> object_points;
+      std::vector<std::vector<Point2f>> image_points;
+      for (size_t i = 0; i < images.size(); i++){
+        if (found[i]){
+          object_points.push_back(board);
+          image_points.push_back(image_corners[i]);
+        }
+      }
+      if (image_points.size() < 3){
+        std::cout << "Found the chessboard in " << image_points.size() << " images, need at least 3\n";
+        return false;
+      }
+
+      std::vector<Mat> rvecs, tvecs;
+      rms_error = calibrateCamera(object_points, image_points, image_size, camera_matrix, dist_coeffs, rvecs, tvecs);
+      std::cout << "Calibrated from " << image_points.size() << " images, rms reprojection error " << rms_error << " px\n"
+                << "fx " << camera_matrix.at<double>(0, 0) << ", fy " << camera_matrix.at<double>(1, 1)
+                << ", cx " << camera_matrix.at<double>(0, 2) << ", cy " << camera_matrix.at<double>(1, 2) << "\n";
+      return true;
+    }
+
+    // Replaces "camera_calibration" in the settings file. Written to a temporary file first and
+    // renamed, so a running instance watching the file never reads half of it.
+    bool writeSettings(const std::string& file_path){
+      json settings;
+      {
+        std::ifstream f(file_path);
+        f >> settings;
+      }
+
+      json calibration;
+      calibration["fx"] = camera_matrix.at<double>(0, 0);
+      calibration["fy"] = camera_matrix.at<double>(1, 1);
+      calibration["cx"] = camera_matrix.at<double>(0, 2);
+      calibration["cy"] = camera_matrix.at<double>(1, 2);
+      calibration["f"] = (camera_matrix.at<double>(0, 0) + camera_matrix.at<double>(1, 1)) / 2.0;
+      std::vector<double> coefficients;
+      for (size_t i = 0; i < dist_coeffs.total(); i++){
+        coefficients.push_back(dist_coeffs.at<double>((int)i));
+      }
+      calibration["dist_coeffs"] = coefficients;
+      calibration["image_width"] = image_size.width;
+      calibration["image_height"] = image_size.height;
+      calibration["rms_error"] = rms_error;
+      settings["camera_calibration"] = calibration;
+
+      std::string temp_path = file_path + ".tmp";
+      {
+        std::ofstream out(temp_path);
+        out << settings.dump(2) << "\n";
+        if (!out){
+          std::cout << "Could not write " << temp_path << "\n";
+          return false;
+        }
+      }
+      if (std::rename(temp_path.c_str(), file_path.c_str()) != 0){
+        std::cout << "Could not replace " << file_path << "\n";
+        return false;
+      }
+      std::cout << "Wrote the intrinsics to " << file_path << "\n";
+      return true;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "dnn_face_detector.hpp"
+#include "p2_quantile.hpp"
+#include "thread_pool.hpp"
+
+using namespace cv;
+
+// Collects the frames that need a DNN face search from all streams and runs them through the
+// network together, so one forward pass covers several frames instead of paying the per-call
+// overhead for each. A batch is sent when max_batch frames are waiting or when the oldest has
+// waited max_wait seconds, whichever comes first: larger batches and longer waits give more
+// frames per second, at the cost of latency. The forward pass runs as a task on the streams'
+// scheduler, with the detector of the worker it lands on, and each frame's callback gets its faces.
+class DnnBatcher {
+  public:
+    typedef std::function<void(const std::vector<Rect>& faces)> Callback;
+
+  private:
+    struct Request {
+      Mat frame;
+      Callback done;
+      std::chrono::steady_clock::time_point queued;
+    };
+
+    TaskScheduler* scheduler;
+    std::vector<DnnFaceDetector*> detectors; // per worker
+    size_t max_batch;
+    std::chrono::steady_clock::duration max_wait;
+
+    std::vector<Request> waiting;
+    std::mutex mutex;
+    std::condition_variable batch_ready;
+    std::thread collector;
+    bool stopping = false;
+
+    std::mutex stats_mutex;
+    long num_batches = 0;
+    long num_full_batches = 0;
+    long num_frames = 0;
+    double total_wait_ms = 0.0;
+    double total_forward_ms = 0.0;
+    P2Quantile wait_p99{0.99};
+
+    void collect(){
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true){
+        batch_ready.wait(lock, [this]{ return stopping || !waiting.empty(); });
+        if (waiting.empty()){
+          return; // stopping and drained
+        }
+        std::chrono::steady_clock::time_point deadline = waiting.front().queued + max_wait;
+        batch_ready.wait_until(lock, deadline, [this]{ return stopping || waiting.size() >= max_batch; });
+
+        size_t size = std::min(waiting.size(), max_batch);
+        std::shared_ptr<std::vector<Request>> batch(new std::vector<Request>());
+        std::move(waiting.begin(), waiting.begin() + size, std::back_inserter(*batch));
+        waiting.erase(waiting.begin(), waiting.begin() + size);
+        lock.unlock();
+        scheduler->submit([this, batch](int worker){ run(*batch, worker); });
+        lock.lock();
+      }
+    }
+
+    void run(std::vector<Request>& batch, int worker){
+      std::vector<Mat> frames;
+      for (const Request& request : batch){
+        frames.push_back(request.frame);
+      }
+      std::vector<std::vector<Rect>> faces;
+      auto t_start = std::chrono::steady_clock::now();
+      detectors[worker]->detectBatch(frames, faces);
+      double forward_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count();
+
+      {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        num_batches++;
+        num_full_batches += batch.size() == max_batch;
+        num_frames += batch.size();
+        total_forward_ms += forward_ms;
+        for (const Request& request : batch){
+          double wait_ms = std::chrono::duration<double, std::milli>(t_start - request.queued).count();
+          total_wait_ms += wait_ms;
+          wait_p99.add(wait_ms);
+        }
+      }
+      for (size_t i = 0; i < batch.size(); i++){
+        batch[i].done(faces[i]);
+      }
+    }
+
+  public:
+    // detectors: one per worker of scheduler, with the batching SSD loaded
+    DnnBatcher(TaskScheduler* scheduler, const std::vector<DnnFaceDetector*>& detectors, int max_batch, double max_wait_seconds)
+      : scheduler(scheduler), detectors(detectors), max_batch(std::max(1, max_batch)) {
+      max_wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(max_wait_seconds));
+      collector = std::thread(&DnnBatcher::collect, this);
+    }
+
+    ~DnnBatcher(){
+      stop();
+    }
+
+    // done is called on a worker of the scheduler with the faces of frame (BGR, full resolution)
+    void add(const Mat& frame, Callback done){
+      size_t size;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting.push_back(Request{ frame, std::move(done), std::chrono::steady_clock::now() });
+        size = waiting.size();
+      }
+      // The collector waits for the first frame, then for a full batch or the deadline
+      if (size == 1 || size >= max_batch){
+        batch_ready.notify_one();
+      }
+    }
+
+    // Sends what is waiting without further delay and ends the collector; the scheduler must
+    // still be running
+    void stop(){
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      batch_ready.notify_one();
+      if (collector.joinable()){
+        collector.join();
+      }
+    }
+
+    int getMaxBatch(){
+      return (int)max_batch;
+    }
+
+    long getNumBatches(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return num_batches;
+    }
+
+    // Batches of max_batch frames, the rest were sent at the deadline or on stop()
+    long getNumFullBatches(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return num_full_batches;
+    }
+
+    double getMeanBatchSize(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return num_batches > 0 ? (double)num_frames / num_batches : 0.0;
+    }
+
+    // Time from queuing a frame to the start of its forward pass
+    double getMeanWaitMillis(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return num_frames > 0 ? total_wait_ms / num_frames : 0.0;
+    }
+
+    double getWaitP99Millis(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return wait_p99.get();
+    }
+
+    // Forward pass time per frame, falls as batches grow if batching pays off
+    double getForwardMillisPerFrame(){
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      return num_frames > 0 ? total_forward_ms / num_frames : 0.0;
+    }
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+#ifdef WITH_DNN
+#include "opencv2/dnn.hpp"
+#include "opencv2/objdetect.hpp"
+#endif
+
+using namespace nlohmann;
+using namespace cv;
+
+#ifdef WITH_DNN
+
+// Neural face detector on the CPU through OpenCV dnn. Two model families are supported:
+//   "ssd":   res10 SSD (Caffe or ONNX), run with cv::dnn directly, output [1, 1, N, 7]
+//   "yunet": YuNet ONNX through FaceDetectorYN, which decodes its anchors
+// The frame is resized to a fixed, small input size into a buffer that is reused, and so are the
+// input blob and the output, so nothing is allocated per frame once the sizes have settled. The SSD also takes a
+// batch of frames in one forward pass (detectBatch()); FaceDetectorYN only takes single images.
+class DnnFaceDetector {
+  private:
+    std::string model_type;
+    Size input_size = Size(160, 120);
+    float score_threshold = 0.6f;
+    dnn::Net net; // ssd
+    Ptr<FaceDetectorYN> yunet;
+    Mat resized; // reused between frames
+    std::vector<Mat> resized_batch;
+    Mat blob;
+    Mat output;
+    bool loaded = false;
+
+    // SSD output row: image id, class, confidence, then the box normalised to [0, 1]
+    void appendSsdFace(const float* detection, Size frame_size, std::vector<Rect>& faces){
+      if (detection[2] < score_threshold){
+        return;
+      }
+      Rect face(cvRound(detection[3] * frame_size.width), cvRound(detection[4] * frame_size.height),
+                cvRound((detection[5] - detection[3]) * frame_size.width), cvRound((detection[6] - detection[4]) * frame_size.height));
+      faces.push_back(face & Rect(0, 0, frame_size.width, frame_size.height));
+    }
+
+  public:
+    static bool isAvailable(){
+      return true;
+    }
+
+    bool isLoaded(){
+      return loaded;
+    }
+
+    bool supportsBatching(){
+      return loaded && model_type == "ssd";
+    }
+
+    bool load(const json& dnn_settings){
+      model_type = dnn_settings.value("type", "yunet");
+      std::string model_path = dnn_settings.value("path_model", "face_detection_yunet_2023mar.onnx");
+      input_size = Size(dnn_settings.value("input_width", 160), dnn_settings.value("input_height", 120));
+      score_threshold = dnn_settings.value("score_threshold", 0.6f);
+
+      try {
+        if (model_type == "ssd"){
+          net = dnn::readNet(model_path, dnn_settings.value("path_config", ""));
+          net.setPreferableBackend(dnn::DNN_BACKEND_OPENCV);
+          net.setPreferableTarget(dnn::DNN_TARGET_CPU);
+          loaded = !net.empty();
+        }
+        else {
+          yunet = FaceDetectorYN::create(model_path, "", input_size, score_threshold);
+          loaded = yunet != NULL;
+        }
+      }
+      catch (const cv::Exception& e){
+        std::cout << "Error loading face detection model " << model_path << ": " << e.what() << "\n";
+        loaded = false;
+      }
+      return loaded;
+    }
+
+    // Face boxes in the coordinates of frame (BGR, any size)
+    void detect(const Mat& frame, std::vector<Rect>& faces){
+      faces.clear();
+      if (!loaded || frame.empty()){
+        return;
+      }
+
+      resize(frame, resized, input_size);
+      double scale_x = (double)frame.cols / input_size.width;
+      double scale_y = (double)frame.rows / input_size.height;
+
+      if (model_type == "ssd"){
+        dnn::blobFromImage(resized, blob, 1.0, input_size, Scalar(104.0, 177.0, 123.0));
+        net.setInput(blob);
+        net.forward(output); // into the buffer of the last call
+
+        const float* detections = output.ptr<float>();
+        size_t num_detections = output.total() / 7;
+        for (size_t i = 0; i < num_detections; i++){
+          appendSsdFace(detections + 7*i, frame.size(), faces);
+        }
+      }
+      else {
+        // Each row: x, y, w, h, five landmarks, score (already thresholded and suppressed)
+        yunet->detect(resized, output);
+        for (int i = 0; i < output.rows; i++){
+          const float* detection = output.ptr<float>(i);
+          Rect face(cvRound(detection[0] * scale_x), cvRound(detection[1] * scale_y),
+                    cvRound(detection[2] * scale_x), cvRound(detection[3] * scale_y));
+          faces.push_back(face & Rect(0, 0, frame.cols, frame.rows));
+        }
+      }
+    }
+
+    // faces[i]: the boxes of frames[i]. One forward pass over all frames for the SSD, whose
+    // detections are tagged with their image; one call per frame otherwise.
+    void detectBatch(const std::vector<Mat>& frames, std::vector<std::vector<Rect>>& faces){
+      faces.resize(frames.size());
+      if (!supportsBatching()){
+        for (size_t i = 0; i < frames.size(); i++){
+          detect(frames[i], faces[i]);
+        }
+        return;
+      }
+
+      resized_batch.resize(frames.size());
+      for (size_t i = 0; i < frames.size(); i++){
+        faces[i].clear();
+        resize(frames[i], resized_batch[i], input_size);
+      }
+      dnn::blobFromImages(resized_batch, blob, 1.0, input_size, Scalar(104.0, 177.0, 123.0));
+      net.setInput(blob);
+      net.forward(output); // into the buffer of the last call
+
+      const float* detections = output.ptr<float>();
+      size_t num_detections = output.total() / 7;
+      for (size_t i = 0; i < num_detections; i++){
+        const float* detection = detections + 7*i;
+        size_t image = (size_t)detection[0];
+        if (image < frames.size()){
+          appendSsdFace(detection, frames[image].size(), faces[image]);
+        }
+      }
+    }
+};
+
+#else
+
+// Built without opencv_dnn: the DNN face backend is unavailable
+class DnnFaceDetector {
+  public:
+    static bool isAvailable(){
+      return false;
+    }
+
+    bool isLoaded(){
+      return false;
+    }
+
+    bool supportsBatching(){
+      return false;
+    }
+
+    bool load(const json&){
+      std::cout << "Built without OpenCV dnn, DNN face backend unavailable\n";
+      return false;
+    }
+
+    void detect(const Mat&, std::vector<Rect>& faces){
+      faces.clear();
+    }
+
+    void detectBatch(const std::vector<Mat>& frames, std::vector<std::vector<Rect>>& faces){
+      faces.assign(frames.size(), std::vector<Rect>());
+    }
+};
+
+#endif
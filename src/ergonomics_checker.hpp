@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+
+#include <chrono>
+
+#include "alert_scheduler.hpp"
+#include "audio_alert.hpp"
+#include "filter_chain.hpp"
+#include "p2_quantile.hpp"
+#include "blink_detector.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+class ErgonomicsChecker {
+  private:
+    int state = 0;
+    double alert_time;
+    SelectableFilterChain position_filter;
+    Position filtered_position = {};
+    Position position_uncertainty = {};
+    double neutral_position[3];
+    double neutral_radius;
+    int num_received = 0;
+    std::chrono::steady_clock::time_point last_OK_time = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_alert = std::chrono::steady_clock::now();
+    std::unique_ptr<AudioAlert> own_audio; // unless one is shared
+    AudioAlert* audio;
+    std::unique_ptr<AlertScheduler> own_scheduler; // unless one is shared
+    AlertScheduler* alert_scheduler;
+    int alert_id;
+    BlinkDetector blink_detector;
+    double min_blink_rate = 8.0; // per minute
+    double fatigue_alert_interval = 300.0; // s
+    std::chrono::steady_clock::time_point last_fatigue_alert;
+
+    // Neutral position calibration: streaming 10 %, 50 % and 90 % quantiles of each axis
+    static constexpr double CALIBRATION_QUANTILES[3] = { 0.1, 0.5, 0.9 };
+    std::atomic<bool> calibration_requested{false};
+    bool calibrating = false;
+    std::chrono::steady_clock::time_point calibration_end;
+    P2Quantile calibration_quantiles[3][3]; // [axis][quantile]
+    double calibration_duration = 10.0; // s
+    double calibration_spread_scale = 2.0;
+    double calibration_min_radius = 0.05; // m
+    int calibration_min_samples = 30;
+
+    void startCalibration(std::chrono::steady_clock::time_point timestamp){
+      for (int axis = 0; axis < 3; axis++){
+        for (int i = 0; i < 3; i++){
+          calibration_quantiles[axis][i] = P2Quantile(CALIBRATION_QUANTILES[i]);
+        }
+      }
+      calibration_end = timestamp + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(calibration_duration));
+      calibrating = true;
+      std::cout << "\nCalibrating the neutral position for " << calibration_duration << " s, sit as you should\n";
+    }
+
+    // Neutral position from the medians, radius from the 10-90 % spread. Runs on the thread that
+    // checks the posture, so no check ever sees half of the new neutral zone.
+    void finishCalibration(){
+      calibrating = false;
+      long num_samples = calibration_quantiles[0][1].getCount();
+      if (num_samples < calibration_min_samples){
+        std::cout << "\nNeutral position calibration failed: only " << num_samples << " locations detected\n";
+        return;
+      }
+      double spread = 0.0;
+      for (int axis = 0; axis < 3; axis++){
+        neutral_position[axis] = calibration_quantiles[axis][1].get();
+        double half_range = (calibration_quantiles[axis][2].get() - calibration_quantiles[axis][0].get()) / 2.0;
+        spread += half_range * half_range;
+      }
+      neutral_radius = std::max(calibration_min_radius, calibration_spread_scale * std::sqrt(spread));
+      std::cout << "\nNeutral position from " << num_samples << " locations: \"neutral_position\": ["
+                << neutral_position[0] << ", " << neutral_position[1] << ", " << neutral_position[2]
+                << "], \"neutral_radius\": " << neutral_radius << "\n";
+    }
+
+  public:
+    // shared_audio, shared_scheduler: one AudioAlert and one AlertScheduler for the checkers of
+    // several users or streams, so they share the sink and the threads; both must outlive them and
+    // the scheduler is started by its owner. NULL: the checker has its own.
+    ErgonomicsChecker(AudioAlert* shared_audio = NULL, AlertScheduler* shared_scheduler = NULL)
+      : audio(shared_audio), alert_scheduler(shared_scheduler) {
+      if (audio == NULL){
+        own_audio.reset(new AudioAlert());
+        audio = own_audio.get();
+      }
+      if (alert_scheduler == NULL){
+        own_scheduler.reset(new AlertScheduler());
+        alert_scheduler = own_scheduler.get();
+      }
+      alert_id = alert_scheduler->addAlert(audio);
+      readJsonSettings("config/settings.json");
+    }
+
+    double getAlertTime(){
+      return alert_time;
+    }
+
+    std::chrono::steady_clock::time_point getLastOKTime(){
+      return last_OK_time;
+    }
+
+    // Seconds left until the user is alerted, negative once the alert has triggered
+    double getCountdown(){
+      double seconds_since_OK = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last_OK_time).count()/1000.0;
+      return alert_time - seconds_since_OK;
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      alert_time = settings["alert_time"];
+      std::cout << "Bad posture alert after: " << alert_time << " s\n";
+      alert_scheduler->setAlertTime(alert_id, alert_time);
+
+      neutral_position[0] = settings["neutral_position"][0];
+      neutral_position[1] = settings["neutral_position"][1];
+      neutral_position[2] = settings["neutral_position"][2];
+      neutral_radius = settings["neutral_radius"];
+
+      json blink_settings = settings.value("blink", json::object());
+      blink_detector.readSettings(blink_settings);
+      min_blink_rate = blink_settings.value("min_rate", 8.0);
+      fatigue_alert_interval = blink_settings.value("alert_interval", 300.0);
+
+      json calibration_settings = settings.value("neutral_calibration", json::object());
+      calibration_duration = calibration_settings.value("duration", 10.0);
+      calibration_spread_scale = calibration_settings.value("spread_scale", 2.0);
+      calibration_min_radius = calibration_settings.value("min_radius", 0.05);
+      calibration_min_samples = calibration_settings.value("min_samples", 30);
+
+      json filter_settings = settings.value("position_filter", json::object());
+      std::string chain = filter_settings.value("chain", "kalman");
+      if (!position_filter.select(chain)){
+        std::cout << "Unknown position filter chain \"" << chain << "\", keeping \"" << position_filter.getName() << "\"\n";
+      }
+      position_filter.readSettings(filter_settings);
+    }
+
+
+    // Per-user overrides in multi-user mode: any of "neutral_position", "neutral_radius" and "alert_time"
+    void applyProfile(const json& profile){
+      if (profile.contains("neutral_position")){
+        for (int axis = 0; axis < 3; axis++){
+          neutral_position[axis] = profile["neutral_position"][axis];
+        }
+      }
+      neutral_radius = profile.value("neutral_radius", neutral_radius);
+      alert_time = profile.value("alert_time", alert_time);
+      alert_scheduler->setAlertTime(alert_id, alert_time);
+    }
+
+    // Feeds a detected location, stamped with the capture time of its frame
+    void addNewLocation(double x, double y, double z, std::chrono::steady_clock::time_point timestamp){
+      position_filter.process(Position{ x, y, z }, timestamp);
+      num_received++;
+
+      if (calibrating){
+        double location[3] = { x, y, z };
+        for (int axis = 0; axis < 3; axis++){
+          for (P2Quantile& quantile : calibration_quantiles[axis]){
+            quantile.add(location[axis]);
+          }
+        }
+      }
+    }
+
+    // Call for every frame, with or without a new location: between detections the position is predicted
+    void calcFilteredLocation(std::chrono::steady_clock::time_point timestamp){
+      position_filter.predict(timestamp, filtered_position, position_uncertainty);
+
+      if (calibration_requested.exchange(false)){
+        startCalibration(timestamp);
+      }
+      else if (calibrating && timestamp >= calibration_end){
+        finishCalibration();
+      }
+    }
+
+    // Call for every frame with its eye openness (negative if the eyes were not seen). Once half the
+    // window has seen the eyes, a blink rate below min_rate plays the fatigue tone, at most once per
+    // alert_interval.
+    void addEyeOpenness(double openness, std::chrono::steady_clock::time_point timestamp){
+      blink_detector.addOpenness(openness, timestamp);
+      if (blink_detector.getObservedSeconds() * 2 >= blink_detector.getWindowSeconds()
+          && blink_detector.getBlinkRate() < min_blink_rate
+          && std::chrono::duration<double>(timestamp - last_fatigue_alert).count() > fatigue_alert_interval){
+        audio->play(AudioAlert::FATIGUE_TONE);
+        last_fatigue_alert = timestamp;
+      }
+    }
+
+    // For a user who has left: keeps the alert countdown from running. Call for every frame while away.
+    void holdAlert(std::chrono::steady_clock::time_point timestamp){
+      last_OK_time = timestamp;
+      alert_scheduler->markPostureOK(alert_id, timestamp);
+    }
+
+    // Forgets the filtered position, so whoever sits down next does not start from the last user's
+    void resetPosition(){
+      position_filter.reset();
+    }
+
+    // Blinks per minute over the blink window
+    double getBlinkRate(){
+      return blink_detector.getBlinkRate();
+    }
+
+    // Measures the neutral position and radius over the next "duration" seconds of frames, while
+    // detection and checking go on. Safe to call from any thread.
+    void requestNeutralCalibration(){
+      calibration_requested = true;
+    }
+
+    bool isCalibrating(){
+      return calibrating;
+    }
+
+    // Locations the filter discarded as outliers since the chain was selected
+    long getRejectedSamples(){
+      return position_filter.getRejectedCount();
+    }
+
+    // Standard deviation of the filtered position per axis, in m
+    Position getPositionUncertainty(){
+      return position_uncertainty;
+    }
+
+    // Compares the latest filtered position with the neutral one and records the OK time (the
+    // capture time of the frame), without alerting
+    bool updatePosture(std::chrono::steady_clock::time_point timestamp){
+
+      // Compare current and neutral position, is it sufficiently close to neutral position?
+      double distance = sqrt(
+        pow(filtered_position[0]-neutral_position[0],2)
+        +pow(filtered_position[1]-neutral_position[1],2)
+        +pow(filtered_position[2]-neutral_position[2],2));
+
+      bool good_posture = false;
+      // If inside, record OK alert_time. While calibrating, the user is sitting as they should.
+      if (distance <= neutral_radius || calibrating){
+        last_OK_time = timestamp;
+        good_posture = true;
+      }
+
+      return good_posture;
+    }
+
+    // Starts the timer-wheel thread that beeps, unless the scheduler is shared. Without it,
+    // checkErgonomics() never alerts (benchmarks); the epoll loop drives fireScheduledAlert() instead.
+    void startAlertScheduler(){
+      if (own_scheduler){
+        own_scheduler->start();
+      }
+    }
+
+    bool checkErgonomics(std::chrono::steady_clock::time_point timestamp){
+      bool good_posture = updatePosture(timestamp);
+
+      // The scheduler fires or postpones the alert by itself
+      if (good_posture){
+        alert_scheduler->markPostureOK(alert_id, timestamp);
+      }
+
+      return good_posture;
+    }
+
+    // For timer-driven alerting: seconds until the next beep is due if the posture stays as it is
+    double getSecondsUntilAlert(){
+      double countdown = getCountdown();
+      if (countdown > 0){
+        return countdown;
+      }
+
+      // No beep yet in this period of bad posture, so the initial beep is due now. The margin
+      // covers an initial beep that fireScheduledAlert() accepted slightly early.
+      auto alert_start = last_OK_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(alert_time - 0.1));
+      if (last_alert < alert_start){
+        return 0.0;
+      }
+
+      double time_since_last_alert = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - last_alert).count()/1000.0;
+      return std::max(0.0, AlertScheduler::getBeepPeriod(countdown) - time_since_last_alert);
+    }
+
+    // For the epoll loop's timerfd: called when the deadline from getSecondsUntilAlert() expires
+    void fireScheduledAlert(){
+      if (getCountdown() > 0.05){
+        return; // posture was corrected in the meantime
+      }
+      audio->play(AlertScheduler::getBeepLevel(getCountdown()));
+      last_alert = std::chrono::steady_clock::now();
+    }
+
+};
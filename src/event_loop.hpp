@@ -0,0 +1,318 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdio>
+#include "json.hpp"
+
+#include <chrono>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "location_detector.hpp"
+#include "ergonomics_checker.hpp"
+#include "preview_window.hpp"
+#include "v4l2_capture.hpp"
+
+using namespace nlohmann;
+
+// Single-threaded alternative to the main loops: the V4L2 capture fd, a timerfd for alerts, an
+// inotify fd for settings.json, a control socket and SIGINT/SIGTERM are all multiplexed with
+// epoll, so the process sleeps in the kernel until something happens and never polls.
+class EventLoop {
+  private:
+    LocationDetector& locDet;
+    ErgonomicsChecker& ergCheck;
+    V4l2Capture camera;
+    std::string settings_dir = "config";
+    std::string settings_name = "settings.json";
+    std::string control_socket_path;
+
+    int epoll_fd = -1;
+    int timer_fd = -1;
+    int inotify_fd = -1;
+    int control_fd = -1;
+    int signal_fd = -1;
+
+    FrameData data;
+    bool good_posture = false;
+    bool running = false;
+    std::chrono::time_point<std::chrono::high_resolution_clock> t_last = std::chrono::high_resolution_clock::now();
+
+    bool fail(const char* what){
+      std::cout << what << " failed: " << strerror(errno) << "\n";
+      return false;
+    }
+
+    bool watch(int fd){
+      epoll_event event;
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN;
+      event.data.fd = fd;
+      return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    void closeFd(int& fd){
+      if (fd >= 0){
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    // One-shot timer, re-armed whenever the next alert deadline changes
+    void armAlertTimer(double seconds){
+      itimerspec spec;
+      memset(&spec, 0, sizeof(spec));
+      if (seconds <= 0.0){
+        spec.it_value.tv_nsec = 1; // zero would disarm the timer
+      }
+      else {
+        spec.it_value.tv_sec = (time_t)seconds;
+        spec.it_value.tv_nsec = (long)((seconds - (double)spec.it_value.tv_sec) * 1e9);
+      }
+      timerfd_settime(timer_fd, 0, &spec, NULL);
+    }
+
+    void onFrame(PreviewWindow* preview){
+      if (!camera.readFrame(data.frame)){
+        return;
+      }
+      locDet.acceptImage(data);
+      locDet.preprocessImage(data);
+      if (locDet.detectFeatures(data) == 2){
+        locDet.calculateLocation(data);
+        ergCheck.addNewLocation(data.xCoord, data.yCoord, data.zCoord, data.timestamp);
+      }
+      ergCheck.calcFilteredLocation(data.timestamp);
+      ergCheck.addEyeOpenness(data.eye_openness, data.timestamp);
+
+      // Only record the posture here, the beeps come from the alert timer
+      good_posture = ergCheck.updatePosture(data.timestamp);
+      armAlertTimer(ergCheck.getSecondsUntilAlert());
+
+      if (preview){
+        preview->publish(data, ergCheck.getCountdown());
+        if (preview->isClosedByUser()){
+          running = false;
+        }
+      }
+
+      auto t_now = std::chrono::high_resolution_clock::now();
+      double elapsedTime = std::chrono::duration<double, std::milli>(t_now-t_last).count();
+      t_last = t_now;
+      std::cout << "\rPosture: " << (good_posture ? "GOOD" : "POOR") << " --- script running at: ~"<<(int)(1000.0/elapsedTime)<< " Hz   " << std::flush;
+    }
+
+    void onAlertTimer(){
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)){
+        return;
+      }
+      ergCheck.fireScheduledAlert();
+      armAlertTimer(ergCheck.getSecondsUntilAlert());
+    }
+
+    void reloadSettings(){
+      // A half-written file fails to parse; the next write triggers another reload
+      try {
+        ergCheck.readJsonSettings(settings_dir + "/" + settings_name);
+        locDet.readJsonSettings(settings_dir + "/" + settings_name);
+        armAlertTimer(ergCheck.getSecondsUntilAlert());
+      }
+      catch (const std::exception& e){
+        std::cout << "\nCould not reload settings: " << e.what() << "\n";
+      }
+    }
+
+    void onSettingsChanged(){
+      alignas(inotify_event) char buffer[4096];
+      ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+      bool changed = false;
+      for (ssize_t offset = 0; offset < length; ){
+        inotify_event* event = (inotify_event*)(buffer + offset);
+        if (event->len > 0 && settings_name == event->name){
+          changed = true;
+        }
+        offset += sizeof(inotify_event) + event->len;
+      }
+      if (changed){
+        std::cout << "\nSettings changed, reloading\n";
+        reloadSettings();
+      }
+    }
+
+    void onControlConnection(){
+      int client_fd = accept4(control_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (client_fd >= 0 && !watch(client_fd)){
+        close(client_fd);
+      }
+    }
+
+    // One command per connection: "status", "reload", "calibrate" or "quit"
+    void onControlCommand(int client_fd){
+      char command[256];
+      ssize_t length = read(client_fd, command, sizeof(command) - 1);
+      if (length < 0 && errno == EAGAIN){
+        return;
+      }
+      command[length > 0 ? length : 0] = '\0';
+      command[strcspn(command, "\r\n")] = '\0';
+
+      char reply[256];
+      if (strcmp(command, "status") == 0){
+        snprintf(reply, sizeof(reply), "%s %.2f %.2f %.2f %.1f %ld %.1f\n", good_posture ? "GOOD" : "POOR",
+                 data.xCoord, data.yCoord, data.zCoord, ergCheck.getCountdown(), ergCheck.getRejectedSamples(), ergCheck.getBlinkRate());
+      }
+      else if (strcmp(command, "reload") == 0){
+        reloadSettings();
+        snprintf(reply, sizeof(reply), "OK\n");
+      }
+      else if (strcmp(command, "calibrate") == 0){
+        ergCheck.requestNeutralCalibration();
+        snprintf(reply, sizeof(reply), "OK\n");
+      }
+      else if (strcmp(command, "quit") == 0){
+        running = false;
+        snprintf(reply, sizeof(reply), "OK\n");
+      }
+      else {
+        snprintf(reply, sizeof(reply), "ERROR unknown command, use status, reload, calibrate or quit\n");
+      }
+
+      if (write(client_fd, reply, strlen(reply)) < 0){
+        // Client went away, nothing to do
+      }
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL);
+      close(client_fd);
+    }
+
+  public:
+    EventLoop(LocationDetector& locDet, ErgonomicsChecker& ergCheck) : locDet(locDet), ergCheck(ergCheck) {
+      readJsonSettings(settings_dir + "/" + settings_name);
+    }
+
+    ~EventLoop(){
+      camera.close();
+      closeFd(timer_fd);
+      closeFd(inotify_fd);
+      closeFd(signal_fd);
+      if (control_fd >= 0){
+        closeFd(control_fd);
+        unlink(control_socket_path.c_str());
+      }
+      closeFd(epoll_fd);
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      control_socket_path = settings.value("control_socket", "/tmp/webcam-ergonomics.sock");
+    }
+
+    // SIGINT and SIGTERM are read from a signalfd, so no thread may have them unblocked: otherwise
+    // the kernel can deliver them to that thread. Call before anything starts a thread (the audio
+    // and eye template threads start in the constructors of ErgonomicsChecker and
+    // LocationDetector), so that every thread inherits the mask. open() calls it again.
+    static sigset_t blockStopSignals(){
+      sigset_t signals;
+      sigemptyset(&signals);
+      sigaddset(&signals, SIGINT);
+      sigaddset(&signals, SIGTERM);
+      pthread_sigmask(SIG_BLOCK, &signals, NULL);
+      return signals;
+    }
+
+    // Sets up every fd. Call blockStopSignals() before starting other threads.
+    bool open(){
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0){
+        return fail("epoll_create1");
+      }
+
+      if (!camera.open(locDet.getWebcamId()) || !watch(camera.getFd())){
+        return false;
+      }
+
+      timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (timer_fd < 0 || !watch(timer_fd)){
+        return fail("timerfd");
+      }
+
+      inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      // Watch the directory, editors often replace the file instead of writing to it
+      if (inotify_fd < 0 || inotify_add_watch(inotify_fd, settings_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0 || !watch(inotify_fd)){
+        return fail("inotify");
+      }
+
+      sigset_t signals = blockStopSignals();
+      signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+      if (signal_fd < 0 || !watch(signal_fd)){
+        return fail("signalfd");
+      }
+
+      sockaddr_un address;
+      memset(&address, 0, sizeof(address));
+      address.sun_family = AF_UNIX;
+      strncpy(address.sun_path, control_socket_path.c_str(), sizeof(address.sun_path) - 1);
+      unlink(control_socket_path.c_str());
+      control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (control_fd < 0 || bind(control_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(control_fd, 4) < 0 || !watch(control_fd)){
+        return fail("control socket");
+      }
+      std::cout << "Control socket: " << control_socket_path << "\n";
+
+      armAlertTimer(ergCheck.getSecondsUntilAlert());
+      return true;
+    }
+
+    // Runs until SIGINT/SIGTERM, a "quit" command or ESC in the preview (if one is given)
+    void run(PreviewWindow* preview = NULL){
+      running = true;
+      epoll_event events[8];
+      while (running){
+        int num_events = epoll_wait(epoll_fd, events, 8, -1);
+        if (num_events < 0){
+          if (errno == EINTR){
+            continue;
+          }
+          fail("epoll_wait");
+          break;
+        }
+
+        for (int i = 0; i < num_events; i++){
+          int fd = events[i].data.fd;
+          if (fd == camera.getFd()){
+            onFrame(preview);
+          }
+          else if (fd == timer_fd){
+            onAlertTimer();
+          }
+          else if (fd == inotify_fd){
+            onSettingsChanged();
+          }
+          else if (fd == control_fd){
+            onControlConnection();
+          }
+          else if (fd == signal_fd){
+            running = false;
+          }
+          else {
+            onControlCommand(fd);
+          }
+        }
+      }
+    }
+};
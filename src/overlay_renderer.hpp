@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string>
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+
+using namespace cv;
+
+// Draws the live preview overlay without per-frame allocations. Text is rasterised into
+// per-line masks that are only redrawn when their value changes; each frame then just paints
+// the masks in the current color. The static labels are rendered once per display size.
+class OverlayRenderer {
+  private:
+    struct TextLine {
+      const char* label;
+      Mat mask; // 255 where text is, sized to the line
+      Rect roi; // line area in display px
+      int baseline_y = 0; // text baseline inside mask
+      int value_x = 0; // where the value starts inside mask
+      char text[64]; // currently rendered value
+      int text_len = -1;
+      std::string value; // reused for putText, keeps its capacity between updates
+
+      TextLine(const char* label) : label(label), text() {}
+    };
+
+    Size display_size;
+    TextLine position_line{ "POSITION: " };
+    TextLine countdown_line{ "COUNTDOWN: " };
+    double font_scale = 0.5;
+
+    Scalar white = Scalar( 255, 255, 255 );
+    Scalar orange = Scalar( 0, 128, 255 );
+    Scalar red = Scalar( 0, 0, 255 );
+
+    // Static part of a line: rendered once, whenever the display size changes
+    void layoutLine(TextLine& line, Point origin){
+      int baseline = 0;
+      Size label_size = getTextSize(line.label, FONT_HERSHEY_SIMPLEX, font_scale, 1, &baseline);
+      int height = label_size.height + baseline + 4;
+
+      line.roi = Rect(origin.x, origin.y - label_size.height - 2, display_size.width - origin.x, height)
+        & Rect(0, 0, display_size.width, display_size.height);
+      line.baseline_y = origin.y - line.roi.y;
+      line.value_x = label_size.width;
+      line.mask.create(line.roi.size(), CV_8UC1);
+      line.mask.setTo(Scalar(0));
+      putText( line.mask, line.label, Point(0, line.baseline_y), FONT_HERSHEY_SIMPLEX, font_scale, Scalar(255) );
+      line.text_len = -1;
+    }
+
+    // Redraws only the value part of the line, and only if the text differs from last time
+    void updateLine(TextLine& line, const char* text, int len){
+      if (line.mask.empty() || (len == line.text_len && memcmp(text, line.text, len) == 0)){
+        return;
+      }
+      memcpy(line.text, text, len);
+      line.text_len = len;
+      line.value.assign(text, len);
+
+      if (line.value_x < line.mask.cols){
+        line.mask.colRange(line.value_x, line.mask.cols).setTo(Scalar(0));
+        putText( line.mask, line.value, Point(line.value_x, line.baseline_y), FONT_HERSHEY_SIMPLEX, font_scale, Scalar(255) );
+      }
+    }
+
+    void paintLine(Mat& frame, TextLine& line, const Scalar& color){
+      if (!line.mask.empty()){
+        frame(line.roi).setTo(color, line.mask);
+      }
+    }
+
+    static char* appendFixed(char* p, char* end, double value, int precision){
+      return std::to_chars(p, end, value, std::chars_format::fixed, precision).ptr;
+    }
+
+    static char* appendText(char* p, char* end, const char* text){
+      size_t len = std::min(strlen(text), (size_t)(end - p));
+      memcpy(p, text, len);
+      return p + len;
+    }
+
+  public:
+    // Draws detections and text onto frame, which must already be display-sized.
+    // Positions are given in capture px and converted with scale (display px per capture px).
+    void render(Mat& frame, double scale, int detection_state, Point face_center, Point eye1_center, Point eye2_center,
+                double xCoord, double yCoord, double zCoord, double countdown){
+      if (frame.size() != display_size){
+        display_size = frame.size();
+        layoutLine(position_line, Point(frame.cols/20, frame.cols/20));
+        layoutLine(countdown_line, Point(frame.cols/20, frame.cols/10));
+      }
+
+      face_center = face_center * scale;
+      eye1_center = eye1_center * scale;
+      eye2_center = eye2_center * scale;
+
+      int radius_eye = frame.cols/20;
+      int radius_face = frame.cols/4;
+
+      // Mark in white if newly found, red if old detection
+      if (detection_state == 2){ // Found both face and eyes
+        circle( frame, face_center, radius_face, white, 2 );
+        circle( frame, eye1_center, radius_eye, white, 1 );
+        circle( frame, eye2_center, radius_eye, white, 1 );
+      }
+      else if (detection_state == 1){ // Found only face
+        circle( frame, face_center, radius_face, white, 2 );
+        circle( frame, eye1_center, radius_eye, red, 1 );
+        circle( frame, eye2_center, radius_eye, red, 1 );
+      }
+      else { // Did not find at all
+        circle( frame, face_center, radius_face, red, 2 );
+        circle( frame, eye1_center, radius_eye, red, 1 );
+        circle( frame, eye2_center, radius_eye, red, 1 );
+      }
+
+      // Format decimals for presentation into fixed stack buffers
+      char buffer[64];
+      char* end = buffer + sizeof(buffer);
+      char* p = appendText(buffer, end, "(");
+      p = appendFixed(p, end, xCoord, 2);
+      p = appendText(p, end, ", ");
+      p = appendFixed(p, end, yCoord, 2);
+      p = appendText(p, end, ", ");
+      p = appendFixed(p, end, zCoord, 2);
+      p = appendText(p, end, ")");
+      updateLine(position_line, buffer, p - buffer);
+
+      p = appendFixed(buffer, end, countdown, 1);
+      p = appendText(p, end, "s");
+      updateLine(countdown_line, buffer, p - buffer);
+
+      Scalar font_color;
+      Scalar font_countdown_color;
+
+      if (countdown > 9.0){
+        font_color = white;
+        font_countdown_color = white;
+      }
+      else if (countdown > 5.0){
+        font_color = red;
+        font_countdown_color = white;
+      }
+      else if (countdown > 0.0){
+        font_color = red;
+        font_countdown_color = orange;
+      }
+      else {
+        font_color = red;
+        font_countdown_color = red;
+      }
+
+      paintLine(frame, position_line, font_color);
+      paintLine(frame, countdown_line, font_countdown_color);
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+
+// Streaming estimate of one quantile with the P² algorithm (Jain & Chlamtac, 1985): five markers
+// track the minimum, the p/2, p and (1+p)/2 quantiles and the maximum, and each sample moves them
+// by a piecewise-parabolic step. O(1) time and memory per sample, no allocation, no sample buffer.
+class P2Quantile {
+  private:
+    double p;
+    double heights[5];
+    double positions[5];
+    double desired[5];
+    double increments[5];
+    long count = 0;
+
+    double parabolic(int i, double d){
+      return heights[i] + d / (positions[i+1] - positions[i-1])
+        * ((positions[i] - positions[i-1] + d) * (heights[i+1] - heights[i]) / (positions[i+1] - positions[i])
+           + (positions[i+1] - positions[i] - d) * (heights[i] - heights[i-1]) / (positions[i] - positions[i-1]));
+    }
+
+    double linear(int i, int d){
+      return heights[i] + d * (heights[i+d] - heights[i]) / (positions[i+d] - positions[i]);
+    }
+
+  public:
+    // quantile in (0, 1), e.g. 0.5 for the median
+    P2Quantile(double quantile = 0.5) : p(quantile) {}
+
+    void reset(){
+      count = 0;
+    }
+
+    long getCount(){
+      return count;
+    }
+
+    void add(double x){
+      // The first five samples are the initial marker heights
+      if (count < 5){
+        heights[count++] = x;
+        if (count == 5){
+          std::sort(heights, heights + 5);
+          for (int i = 0; i < 5; i++){
+            positions[i] = i;
+          }
+          desired[0] = 0.0; desired[1] = 2*p; desired[2] = 4*p; desired[3] = 2 + 2*p; desired[4] = 4.0;
+          increments[0] = 0.0; increments[1] = p/2; increments[2] = p; increments[3] = (1 + p)/2; increments[4] = 1.0;
+        }
+        return;
+      }
+
+      // Cell the sample falls in, stretching the extremes if needed
+      int k;
+      if (x < heights[0]){
+        heights[0] = x;
+        k = 0;
+      }
+      else if (x >= heights[4]){
+        heights[4] = x;
+        k = 3;
+      }
+      else {
+        k = 0;
+        while (x >= heights[k+1]){
+          k++;
+        }
+      }
+      for (int i = k + 1; i < 5; i++){
+        positions[i] += 1.0;
+      }
+      for (int i = 0; i < 5; i++){
+        desired[i] += increments[i];
+      }
+
+      // Move the middle markers towards their desired positions by one
+      for (int i = 1; i < 4; i++){
+        double offset = desired[i] - positions[i];
+        if ((offset >= 1.0 && positions[i+1] - positions[i] > 1.0) || (offset <= -1.0 && positions[i-1] - positions[i] < -1.0)){
+          int d = offset > 0 ? 1 : -1;
+          double height = parabolic(i, d);
+          heights[i] = heights[i-1] < height && height < heights[i+1] ? height : linear(i, d);
+          positions[i] += d;
+        }
+      }
+      count++;
+    }
+
+    double get(){
+      if (count >= 5){
+        return heights[2];
+      }
+      if (count == 0){
+        return 0.0;
+      }
+      // Too few samples for the markers: the exact quantile of what there is
+      double sorted[5];
+      std::copy(heights, heights + count, sorted);
+      std::sort(sorted, sorted + count);
+      return sorted[(int)(p * (count - 1) + 0.5)];
+    }
+};
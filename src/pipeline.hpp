@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+#include "location_detector.hpp"
+#include "ergonomics_checker.hpp"
+#include "spsc_queue.hpp"
+
+using namespace nlohmann;
+
+// Runs capture -> preprocess -> detect -> geometry -> check on one thread each, connected by
+// bounded SPSC queues, so throughput is limited by the slowest stage instead of the sum of all.
+class Pipeline {
+  private:
+    LocationDetector& locDet;
+    ErgonomicsChecker& ergCheck;
+    size_t queue_capacity;
+    OverflowPolicy policy;
+
+    std::unique_ptr<SpscQueue<FrameData>> captured;
+    std::unique_ptr<SpscQueue<FrameData>> preprocessed;
+    std::unique_ptr<SpscQueue<FrameData>> detected;
+    std::unique_ptr<SpscQueue<FrameData>> located;
+    std::unique_ptr<SpscQueue<FrameData>> checked;
+
+    std::vector<std::thread> stages;
+    std::atomic<bool> running{false};
+
+    void captureStage(){
+      while (running){
+        FrameData data;
+        if (!locDet.captureImage(data)){
+          break; // end of stream
+        }
+        if (!captured->push(std::move(data))){
+          break;
+        }
+      }
+      captured->close();
+    }
+
+    void preprocessStage(){
+      FrameData data;
+      while (captured->pop(data)){
+        locDet.preprocessImage(data);
+        if (!preprocessed->push(std::move(data))){
+          break;
+        }
+      }
+      preprocessed->close();
+    }
+
+    void detectStage(){
+      FrameData data;
+      while (preprocessed->pop(data)){
+        locDet.detectFeatures(data);
+        if (!detected->push(std::move(data))){
+          break;
+        }
+      }
+      detected->close();
+    }
+
+    void geometryStage(){
+      FrameData data;
+      while (detected->pop(data)){
+        if (data.detection_state == 2){
+          locDet.calculateLocation(data);
+        }
+        if (!located->push(std::move(data))){
+          break;
+        }
+      }
+      located->close();
+    }
+
+    void checkStage(){
+      FrameData data;
+      while (located->pop(data)){
+        if (data.detection_state == 2){
+          ergCheck.addNewLocation(data.xCoord, data.yCoord, data.zCoord, data.timestamp);
+        }
+        ergCheck.calcFilteredLocation(data.timestamp);
+        ergCheck.addEyeOpenness(data.eye_openness, data.timestamp);
+
+        // Regardless of whether location detected, use latest valid data to check ergo
+        data.good_posture = ergCheck.checkErgonomics(data.timestamp);
+        data.countdown = ergCheck.getCountdown();
+        if (!checked->push(std::move(data))){
+          break;
+        }
+      }
+      checked->close();
+    }
+
+  public:
+    // every_frame: block instead of dropping when a queue is full, e.g. when replaying a file
+    Pipeline(LocationDetector& locDet, ErgonomicsChecker& ergCheck, bool every_frame = false) : locDet(locDet), ergCheck(ergCheck) {
+      readJsonSettings("config/settings.json");
+      if (every_frame){
+        policy = OverflowPolicy::BLOCK;
+      }
+
+      captured.reset(new SpscQueue<FrameData>(queue_capacity, policy));
+      preprocessed.reset(new SpscQueue<FrameData>(queue_capacity, policy));
+      detected.reset(new SpscQueue<FrameData>(queue_capacity, policy));
+      located.reset(new SpscQueue<FrameData>(queue_capacity, policy));
+      checked.reset(new SpscQueue<FrameData>(queue_capacity, policy));
+    }
+
+    ~Pipeline(){
+      stop();
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      // Older settings files have no pipeline section
+      json pipeline_settings = settings.value("pipeline", json::object());
+      queue_capacity = pipeline_settings.value("queue_capacity", 4);
+      policy = pipeline_settings.value("drop_oldest", true) ? OverflowPolicy::DROP_OLDEST : OverflowPolicy::BLOCK;
+      std::cout << "Pipeline queue capacity: " << queue_capacity << " frames, "
+                << (policy == OverflowPolicy::DROP_OLDEST ? "dropping oldest" : "blocking") << " when full\n";
+    }
+
+    void start(){
+      running = true;
+      stages.emplace_back(&Pipeline::captureStage, this);
+      stages.emplace_back(&Pipeline::preprocessStage, this);
+      stages.emplace_back(&Pipeline::detectStage, this);
+      stages.emplace_back(&Pipeline::geometryStage, this);
+      stages.emplace_back(&Pipeline::checkStage, this);
+    }
+
+    // Stops capturing and unblocks every stage; frames still in flight are discarded
+    void stop(){
+      running = false;
+      captured->close();
+      preprocessed->close();
+      detected->close();
+      located->close();
+      checked->close();
+      for (std::thread& stage : stages){
+        stage.join();
+      }
+      stages.clear();
+    }
+
+    // Blocks until the next checked frame is ready. Returns false once the stream has ended.
+    bool getResult(FrameData& data){
+      return checked->pop(data);
+    }
+
+    // Frames discarded by the drop-oldest policy across all queues
+    long getDroppedFrames(){
+      return captured->getDroppedCount() + preprocessed->getDroppedCount() + detected->getDroppedCount()
+        + located->getDroppedCount() + checked->getDroppedCount();
+    }
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// Constant-velocity Kalman filter for one axis, state [position, velocity] with white-noise
+// acceleration. Every step is a handful of multiply-adds on the 2x2 covariance.
+struct AxisKalman {
+  double position = 0.0;
+  double velocity = 0.0;
+  double p00 = 0.0, p01 = 0.0, p11 = 0.0; // symmetric covariance
+
+  void reset(double measurement, double measurement_var, double velocity_var){
+    position = measurement;
+    velocity = 0.0;
+    p00 = measurement_var;
+    p01 = 0.0;
+    p11 = velocity_var;
+  }
+
+  void predict(double dt, double process_noise){
+    position += velocity * dt;
+    p00 += dt * (2.0 * p01 + dt * p11) + process_noise * dt * dt * dt / 3.0;
+    p01 += dt * p11 + process_noise * dt * dt / 2.0;
+    p11 += process_noise * dt;
+  }
+
+  void correct(double measurement, double measurement_var){
+    double s = p00 + measurement_var;
+    double k0 = p00 / s;
+    double k1 = p01 / s;
+    double residual = measurement - position;
+    position += k0 * residual;
+    velocity += k1 * residual;
+    p11 -= k1 * p01;
+    p01 -= k0 * p01;
+    p00 -= k0 * p00;
+  }
+};
+
+// Smooths the x, y, z estimates using the real capture timestamps. Measurements correct the
+// filter; in between (skipped or failed detections) the position is extrapolated from the last
+// estimate, for at most max_prediction seconds, while the uncertainty keeps growing.
+class PositionFilter {
+  private:
+    AxisKalman axes[3];
+    double process_noise = 0.5; // acceleration spectral density, m^2/s^3
+    double measurement_var[3] = { 1e-4, 1e-4, 9e-4 }; // m^2, depth from the eye distance is noisier
+    double max_prediction = 0.5; // seconds
+    bool initialized = false;
+    std::chrono::steady_clock::time_point last_update;
+
+    static double secondsBetween(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to){
+      return std::chrono::duration<double>(to - from).count();
+    }
+
+  public:
+    void setNoise(double process, const double measurement_std[3]){
+      process_noise = process;
+      for (int i = 0; i < 3; i++){
+        measurement_var[i] = measurement_std[i] * measurement_std[i];
+      }
+    }
+
+    void setMaxPrediction(double seconds){
+      max_prediction = seconds;
+    }
+
+    bool isInitialized(){
+      return initialized;
+    }
+
+    void update(const double measurement[3], std::chrono::steady_clock::time_point timestamp){
+      if (!initialized){
+        for (int i = 0; i < 3; i++){
+          axes[i].reset(measurement[i], measurement_var[i], 1.0);
+        }
+        initialized = true;
+        last_update = timestamp;
+        return;
+      }
+
+      // Out of order samples (e.g. from a reordering pipeline) are fused without a time step
+      double dt = std::max(0.0, secondsBetween(last_update, timestamp));
+      for (int i = 0; i < 3; i++){
+        axes[i].predict(dt, process_noise);
+        axes[i].correct(measurement[i], measurement_var[i]);
+      }
+      last_update = std::max(last_update, timestamp);
+    }
+
+    // Estimate at timestamp without changing the filter state. Uncertainty is the standard
+    // deviation of each position component. Returns false before the first measurement.
+    bool predict(std::chrono::steady_clock::time_point timestamp, double position[3], double uncertainty[3] = NULL){
+      if (!initialized){
+        return false;
+      }
+
+      double dt = std::max(0.0, secondsBetween(last_update, timestamp));
+      double extrapolate = std::min(dt, max_prediction);
+      for (int i = 0; i < 3; i++){
+        AxisKalman predicted = axes[i];
+        predicted.predict(dt, process_noise);
+        position[i] = axes[i].position + axes[i].velocity * extrapolate;
+        if (uncertainty){
+          uncertainty[i] = std::sqrt(predicted.p00);
+        }
+      }
+      return true;
+    }
+};
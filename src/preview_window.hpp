@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+#ifdef WITH_HIGHGUI
+#include "opencv2/highgui.hpp"
+#endif
+
+#include "json.hpp"
+
+#include "location_detector.hpp"
+#include "overlay_renderer.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// What the UI thread needs to draw one preview frame
+struct PreviewFrame {
+  Mat display_frame; // color frame at preview scale, drawn on by the UI thread
+  double scale = 1.0; // display px per capture px
+  int detection_state = 0;
+  Point eye1_center = Point( 0, 0 );
+  Point eye2_center = Point( 0, 0 );
+  Point face_center = Point( 0, 0 );
+  double xCoord = 0.0;
+  double yCoord = 0.0;
+  double zCoord = 0.0;
+  double countdown = 0.0;
+};
+
+#ifdef WITH_HIGHGUI
+
+// Live preview on its own UI thread. The detection loop only fills a back buffer and swaps it
+// in under a lock that is held for a pointer swap, so it never waits for imshow or waitKey.
+class PreviewWindow {
+  private:
+    PreviewFrame back; // written by the detection thread only
+    PreviewFrame pending; // latest published frame, exchanged under swap_mutex
+    PreviewFrame front; // rendered by the UI thread only
+    bool pending_fresh = false;
+    std::mutex swap_mutex;
+
+    OverlayRenderer overlay;
+    double preview_scale;
+    std::atomic<double> overlay_micros{0.0}; // smoothed overlay cost per frame
+
+    std::thread ui_thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> closed_by_user{false};
+
+    void uiLoop(){
+      while (running){
+        bool fresh = false;
+        {
+          std::lock_guard<std::mutex> lock(swap_mutex);
+          if (pending_fresh){
+            std::swap(front, pending);
+            pending_fresh = false;
+            fresh = true;
+          }
+        }
+
+        if (fresh){
+          auto t_start = std::chrono::steady_clock::now();
+          overlay.render(front.display_frame, front.scale, front.detection_state, front.face_center, front.eye1_center, front.eye2_center,
+                         front.xCoord, front.yCoord, front.zCoord, front.countdown);
+          double micros = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t_start).count();
+          overlay_micros = 0.9*overlay_micros + 0.1*micros;
+
+          imshow( "webcam-ergonomics LIVE FEED", front.display_frame );
+        }
+
+        if( waitKey(10) == 27 ){ // stop upon pressing ESC key when preview is in focus
+          closed_by_user = true;
+        }
+      }
+      destroyAllWindows();
+    }
+
+  public:
+    PreviewWindow(){
+      readJsonSettings("config/settings.json");
+    }
+
+    static bool isAvailable(){
+      return true;
+    }
+
+    ~PreviewWindow(){
+      stop();
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      // Display px per capture px
+      preview_scale = settings.value("preview_scale", 0.5);
+    }
+
+    void start(){
+      running = true;
+      ui_thread = std::thread(&PreviewWindow::uiLoop, this);
+    }
+
+    void stop(){
+      running = false;
+      if (ui_thread.joinable()){
+        ui_thread.join();
+      }
+    }
+
+    // Called from the detection loop. Scales the frame into the back buffer (reusing its
+    // allocation) and swaps it in as the latest frame; an unrendered older frame is replaced.
+    void publish(const FrameData& data, double countdown){
+      Size display_size(cvRound(data.frame.cols * preview_scale), cvRound(data.frame.rows * preview_scale));
+      if (display_size == data.frame_small.size()){
+        // Preprocessing already produced a frame of the right size
+        data.frame_small.copyTo(back.display_frame);
+      }
+      else {
+        resize(data.frame, back.display_frame, display_size, 0, 0, INTER_AREA);
+      }
+      back.scale = preview_scale;
+      back.detection_state = data.detection_state;
+      back.eye1_center = data.eye1_center;
+      back.eye2_center = data.eye2_center;
+      back.face_center = data.face_center;
+      back.xCoord = data.xCoord;
+      back.yCoord = data.yCoord;
+      back.zCoord = data.zCoord;
+      back.countdown = countdown;
+
+      std::lock_guard<std::mutex> lock(swap_mutex);
+      std::swap(back, pending);
+      pending_fresh = true;
+    }
+
+    double getOverlayMicros(){
+      return overlay_micros;
+    }
+
+    // True once ESC has been pressed in the preview window
+    bool isClosedByUser(){
+      return closed_by_user;
+    }
+};
+
+#else
+
+// Headless build (WITH_HIGHGUI=OFF): no preview, and nothing links against opencv_highgui
+class PreviewWindow {
+  public:
+    static bool isAvailable(){
+      return false;
+    }
+
+    void start(){}
+    void stop(){}
+    void publish(const FrameData&, double){}
+
+    double getOverlayMicros(){
+      return -1.0;
+    }
+
+    bool isClosedByUser(){
+      return false;
+    }
+};
+
+#endif
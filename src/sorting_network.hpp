@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Four doubles processed side by side, one lane per axis (x, y, z and one spare lane)
+struct alignas(32) Lanes {
+  double v[4];
+};
+
+// Puts the lane-wise minimum in a and the maximum in b, without branches
+inline void compareExchange(Lanes& a, Lanes& b){
+#if defined(__AVX__)
+  __m256d x = _mm256_load_pd(a.v);
+  __m256d y = _mm256_load_pd(b.v);
+  _mm256_store_pd(a.v, _mm256_min_pd(x, y));
+  _mm256_store_pd(b.v, _mm256_max_pd(x, y));
+#elif defined(__SSE2__)
+  for (int half = 0; half < 4; half += 2){
+    __m128d x = _mm_load_pd(a.v + half);
+    __m128d y = _mm_load_pd(b.v + half);
+    _mm_store_pd(a.v + half, _mm_min_pd(x, y));
+    _mm_store_pd(b.v + half, _mm_max_pd(x, y));
+  }
+#else
+  for (int lane = 0; lane < 4; lane++){
+    double lo = std::fmin(a.v[lane], b.v[lane]);
+    b.v[lane] = std::fmax(a.v[lane], b.v[lane]);
+    a.v[lane] = lo;
+  }
+#endif
+}
+
+// Sorts every lane of values independently with an odd-even transposition network. The sequence
+// of comparisons is fixed by N, so the loops unroll completely and nothing depends on the data.
+template <int N>
+inline void sortLanes(Lanes (&values)[N]){
+  for (int round = 0; round < N; round++){
+    for (int i = round % 2; i + 1 < N; i += 2){
+      compareExchange(values[i], values[i + 1]);
+    }
+  }
+}
+
+// Lane-wise median of N (odd) values; values ends up sorted
+template <int N>
+inline Lanes medianLanes(Lanes (&values)[N]){
+  static_assert(N % 2 == 1, "median needs an odd number of values");
+  sortLanes(values);
+  return values[N / 2];
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// What push() does when the queue is full
+enum class OverflowPolicy {
+  BLOCK,       // wait for the consumer, every item is delivered
+  DROP_OLDEST  // discard the oldest queued item, keeps latency bounded for live capture
+};
+
+// Bounded single-producer/single-consumer ring queue. Each slot carries a sequence number
+// (as in Vyukov's bounded queue) so that the producer can safely act as a second consumer
+// when it discards the oldest item under DROP_OLDEST. A side that has to wait spins briefly, then
+// sleeps on a condition variable; the other side only takes the mutex to wake it if it has
+// announced that it sleeps, so a busy queue never locks.
+template <typename T>
+class SpscQueue {
+  private:
+    struct Slot {
+      std::atomic<size_t> sequence;
+      T item;
+    };
+
+    size_t capacity;
+    OverflowPolicy policy;
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+    std::atomic<bool> closed{false};
+    std::atomic<long> num_dropped{0};
+
+    static constexpr int SPIN_ATTEMPTS = 64;
+    std::mutex wait_mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+
+    bool canPush(size_t pos){
+      return slots[pos % capacity].sequence.load(std::memory_order_acquire) == pos;
+    }
+
+    bool canPop(){
+      size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+      return slots[pos % capacity].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Sleeps until ready() or close(). The flag is set before ready() is checked again and the other
+    // side reads it after publishing its change, both behind a full fence, so one of them sees the other.
+    template <typename Ready>
+    void sleepUntil(std::atomic<bool>& waiting, std::condition_variable& wake, Ready ready){
+      std::unique_lock<std::mutex> lock(wait_mutex);
+      waiting.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      wake.wait(lock, [&]{ return ready() || closed.load(std::memory_order_acquire); });
+      waiting.store(false, std::memory_order_relaxed);
+    }
+
+    void wakeIfWaiting(std::atomic<bool>& waiting, std::condition_variable& wake){
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (waiting.load(std::memory_order_relaxed)){
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        wake.notify_one();
+      }
+    }
+
+  public:
+    SpscQueue(size_t capacity, OverflowPolicy policy) : capacity(capacity < 1 ? 1 : capacity), policy(policy) {
+      slots.reset(new Slot[this->capacity]);
+      for (size_t i = 0; i < this->capacity; i++){
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    // Producer side. Returns false if the queue was closed before the item could be stored.
+    bool push(T&& item){
+      size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+      Slot& slot = slots[pos % capacity];
+
+      int attempt = 0;
+      while (!canPush(pos)){
+        // Slot still holds the item from one lap ago, so the queue is full
+        if (closed.load(std::memory_order_acquire)){
+          return false;
+        }
+        if (policy == OverflowPolicy::DROP_OLDEST){
+          T discarded;
+          if (tryPop(discarded)){
+            num_dropped++;
+          }
+          // If the consumer is mid-read of this very slot, it is released within a move
+          std::this_thread::yield();
+        }
+        else if (attempt++ < SPIN_ATTEMPTS){
+          std::this_thread::yield();
+        }
+        else {
+          sleepUntil(producer_waiting, not_full, [&]{ return canPush(pos); });
+        }
+      }
+
+      slot.item = std::move(item);
+      slot.sequence.store(pos + 1, std::memory_order_release);
+      enqueue_pos.store(pos + 1, std::memory_order_relaxed);
+      // The consumer only sleeps on an empty queue, so this locks only after filling an empty one
+      wakeIfWaiting(consumer_waiting, not_empty);
+      return true;
+    }
+
+    // Consumer side (also used by the producer to drop). Returns false if the queue is empty.
+    bool tryPop(T& item){
+      size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+      while (true){
+        Slot& slot = slots[pos % capacity];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        long diff = (long)sequence - (long)(pos + 1);
+
+        if (diff == 0){
+          if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+            item = std::move(slot.item);
+            slot.sequence.store(pos + capacity, std::memory_order_release);
+            return true;
+          }
+          // Lost the race, pos now holds the current dequeue position
+        }
+        else if (diff < 0){
+          return false;
+        }
+        else {
+          pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Blocks until an item is available. Returns false once the queue is closed and drained.
+    bool pop(T& item){
+      int attempt = 0;
+      while (!tryPop(item)){
+        if (closed.load(std::memory_order_acquire)){
+          return tryPop(item);
+        }
+        if (attempt++ < SPIN_ATTEMPTS){
+          std::this_thread::yield();
+        }
+        else {
+          sleepUntil(consumer_waiting, not_empty, [this]{ return canPop(); });
+        }
+      }
+      if (policy == OverflowPolicy::BLOCK){
+        wakeIfWaiting(producer_waiting, not_full);
+      }
+      return true;
+    }
+
+    // No more items will be pushed; wakes up a blocked producer or consumer
+    void close(){
+      {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        closed.store(true, std::memory_order_release);
+      }
+      not_empty.notify_all();
+      not_full.notify_all();
+    }
+
+    long getDroppedCount(){
+      return num_dropped.load();
+    }
+};
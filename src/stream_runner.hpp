@@ -0,0 +1,396 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json.hpp"
+
+#include <opencv2/core.hpp>
+
+#include "location_detector.hpp"
+#include "ergonomics_checker.hpp"
+#include "thread_pool.hpp"
+#include "work_stealing_pool.hpp"
+#include "dnn_batcher.hpp"
+#include "p2_quantile.hpp"
+
+using namespace nlohmann;
+using namespace cv;
+
+// Monitors several cameras or videos ("streams" in settings.json) in one process. Every stream has
+// its own LocationDetector and ErgonomicsChecker, so trackers, filters and alerts are per stream
+// (the tones all go to one shared AudioAlert), and a capture thread that hands the latest frame to
+// a one-slot mailbox. Processing runs on a shared TaskScheduler as three tasks per frame: face
+// search (or eye tracking), eye detection, and geometry plus check. A stream has one frame in
+// detection at a time, since each frame's search starts from the trackers left by the previous one,
+// but its next frame is detected while the last one is checked; checks are queued per stream and
+// run one at a time in frame order, as the ErgonomicsChecker's filter needs. The detector models
+// are loaded once per worker rather than per stream: OpenCV's cascades and networks must not be
+// used by two threads at once, and a task borrows the set of the worker it runs on. The eye
+// template refreshes are pool tasks too, with the worker's eye cascade. With the SSD face detector,
+// the face searches of all streams go through a DnnBatcher ("dnn_batching"), which runs them in
+// shared forward passes.
+class StreamRunner {
+  public:
+    struct Stream {
+      std::string name;
+      bool live; // a camera: a new frame replaces a waiting one. A video: capture waits instead.
+      std::unique_ptr<AudioAlert> audio; // with its own "wav_path", else the runner's is shared
+      std::unique_ptr<LocationDetector> locDet;
+      std::unique_ptr<ErgonomicsChecker> ergCheck;
+      std::thread capture_thread;
+
+      std::mutex mutex;
+      std::condition_variable slot_free;
+      FrameData pending;
+      bool has_pending = false;
+      bool in_flight = false; // a frame is in detection
+      std::deque<std::shared_ptr<FrameData>> detected; // waiting for their check, in frame order
+      bool checking = false; // a check task is queued or running
+      bool ended = false;
+
+      std::atomic<long> num_frames{0};
+      std::atomic<long> num_dropped{0};
+      std::atomic<bool> good_posture{false};
+      std::vector<double> latencies_ms; // capture to check, with setRecordLatencies(); only touched by the check task
+      P2Quantile latency_p99{0.99}; // kept for every frame, guarded by mutex
+
+      double getLatencyP99Millis(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return latency_p99.get();
+      }
+    };
+
+  private:
+    AudioAlert audio; // before the streams, whose checkers use it
+    AlertScheduler alert_scheduler; // one timer per stream
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<DetectorModels>> worker_models;
+    std::unique_ptr<TaskScheduler> pool;
+    std::atomic<bool> running{false};
+    int num_threads = 0;
+    bool work_stealing = true;
+    long num_stolen = 0;
+    std::unique_ptr<DnnBatcher> batcher;
+    bool batching = true;
+    int max_batch = 4;
+    double max_wait = 0.005;
+    int opencv_threads = 1;
+    bool record_latencies = false;
+    json configured_streams;
+
+    void captureLoop(Stream& stream){
+      while (running){
+        FrameData data;
+        if (!stream.locDet->captureImage(data)){
+          break; // end of stream
+        }
+        bool submit;
+        {
+          std::unique_lock<std::mutex> lock(stream.mutex);
+          if (!stream.live){
+            stream.slot_free.wait(lock, [&]{ return !stream.has_pending || !running; });
+          }
+          if (stream.has_pending){
+            stream.num_dropped++;
+          }
+          stream.pending = std::move(data);
+          stream.has_pending = true;
+          submit = !stream.in_flight;
+          stream.in_flight = true;
+        }
+        if (submit){
+          scheduleDetection(stream);
+        }
+      }
+      std::lock_guard<std::mutex> lock(stream.mutex);
+      stream.ended = true;
+    }
+
+    void scheduleDetection(Stream& stream){
+      pool->submit([this, &stream](int worker){ findFace(stream, worker); });
+    }
+
+    void findFace(Stream& stream, int worker){
+      std::shared_ptr<FrameData> data(new FrameData());
+      {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        *data = std::move(stream.pending);
+        stream.has_pending = false;
+      }
+      stream.slot_free.notify_one();
+
+      stream.locDet->useModels(worker_models[worker].get());
+      stream.locDet->preprocessImage(*data);
+      if (batcher && stream.locDet->usesDnnFaces()){
+        if (stream.locDet->trackEyes(*data)){
+          finishDetection(stream, data);
+          return;
+        }
+        batcher->add(data->frame, [this, &stream, data](const std::vector<Rect>& faces){
+          if (stream.locDet->selectFace(*data, faces) == 1){
+            scheduleEyes(stream, data);
+          }
+          else {
+            finishDetection(stream, data);
+          }
+        });
+        return;
+      }
+      if (stream.locDet->findFace(*data) == 1){
+        scheduleEyes(stream, data);
+      }
+      else {
+        finishDetection(stream, data);
+      }
+    }
+
+    void scheduleEyes(Stream& stream, const std::shared_ptr<FrameData>& data){
+      pool->submit([this, &stream, data](int worker){ findEyes(stream, *data, worker); finishDetection(stream, data); });
+    }
+
+    void findEyes(Stream& stream, FrameData& data, int worker){
+      stream.locDet->useModels(worker_models[worker].get());
+      stream.locDet->findEyes(data);
+    }
+
+    // Queues the frame's check and starts detecting the next frame, if one is waiting
+    void finishDetection(Stream& stream, const std::shared_ptr<FrameData>& data){
+      bool start_check, again;
+      {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.detected.push_back(data);
+        start_check = !stream.checking;
+        stream.checking = true;
+        again = stream.has_pending;
+        stream.in_flight = again;
+      }
+      if (start_check){
+        pool->submit([this, &stream](int){ check(stream); });
+      }
+      if (again){
+        scheduleDetection(stream);
+      }
+    }
+
+    void check(Stream& stream){
+      std::shared_ptr<FrameData> data;
+      {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        data = std::move(stream.detected.front());
+        stream.detected.pop_front();
+      }
+
+      ErgonomicsChecker& ergCheck = *stream.ergCheck;
+      if (data->detection_state == 2){
+        stream.locDet->calculateLocation(*data);
+        ergCheck.addNewLocation(data->xCoord, data->yCoord, data->zCoord, data->timestamp);
+      }
+      ergCheck.calcFilteredLocation(data->timestamp);
+      ergCheck.addEyeOpenness(data->eye_openness, data->timestamp);
+      stream.good_posture = ergCheck.checkErgonomics(data->timestamp);
+      double latency_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - data->timestamp).count();
+      if (record_latencies){
+        stream.latencies_ms.push_back(latency_ms);
+      }
+      stream.num_frames++;
+
+      bool again;
+      {
+        std::lock_guard<std::mutex> lock(stream.mutex);
+        stream.latency_p99.add(latency_ms);
+        again = !stream.detected.empty();
+        stream.checking = again;
+      }
+      if (again){
+        pool->submit([this, &stream](int){ check(stream); });
+      }
+    }
+
+    void readJsonSettings(String file_path){
+      std::ifstream f(file_path);
+      json settings;
+      f >> settings;
+
+      json stream_settings = settings.value("streams", json::object());
+      if (num_threads <= 0){
+        num_threads = stream_settings.value("threads", 0);
+      }
+      if (num_threads <= 0){
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      opencv_threads = stream_settings.value("opencv_threads", 1);
+      work_stealing = stream_settings.value("scheduler", "work_stealing") != "fifo";
+      json batch_settings = stream_settings.value("dnn_batching", json::object());
+      batching = batch_settings.value("enabled", true);
+      max_batch = batch_settings.value("max_batch", 4);
+      max_wait = batch_settings.value("max_wait", 0.005);
+      configured_streams = stream_settings.value("list", json::array());
+
+      // With the backends every stream's detector will select
+      for (int i = 0; i < num_threads; i++){
+        worker_models.emplace_back(new DetectorModels());
+        worker_models.back()->load(settings);
+      }
+    }
+
+  public:
+    // The streams listed under "streams" in settings.json
+    StreamRunner(){
+      readJsonSettings("config/settings.json");
+      addStreams(configured_streams);
+    }
+
+    // stream_list entries: {"name", "camera_id" or "video", and optionally the ErgonomicsChecker
+    // overrides of ErgonomicsChecker::applyProfile() and a "wav_path" for the stream's alerts}.
+    // num_threads <= 0 takes "threads" from settings.json.
+    StreamRunner(const json& stream_list, int num_threads) : num_threads(num_threads) {
+      readJsonSettings("config/settings.json");
+      addStreams(stream_list);
+    }
+
+    // Before start(): per-worker deques with stealing, or one shared FIFO queue
+    void setWorkStealing(bool enabled){
+      work_stealing = enabled;
+    }
+
+    // Before start(): DNN face searches per forward pass, 1 for no batching
+    void setMaxBatch(int frames){
+      max_batch = frames;
+    }
+
+    // Before start(): keep every frame's latency in Stream::latencies_ms, for benchmarks; the p99
+    // is kept either way
+    void setRecordLatencies(bool enabled){
+      record_latencies = enabled;
+    }
+
+    ~StreamRunner(){
+      stop();
+    }
+
+    // Before start()
+    void addStreams(const json& stream_list){
+      for (const json& entry : stream_list){
+        std::unique_ptr<Stream> stream(new Stream());
+        stream->name = entry.value("name", "stream " + std::to_string(streams.size() + 1));
+        stream->live = !entry.contains("video");
+        stream->locDet.reset(new LocationDetector(entry, worker_models[0].get(), [this](std::function<void(CascadeClassifier&)> job){
+          pool->submit([this, job](int worker){ job(worker_models[worker]->eyes_cascade); });
+        }));
+        if (entry.contains("wav_path")){
+          stream->audio.reset(new AudioAlert(entry["wav_path"].get<std::string>()));
+        }
+        stream->ergCheck.reset(new ErgonomicsChecker(stream->audio ? stream->audio.get() : &audio, &alert_scheduler));
+        stream->ergCheck->applyProfile(entry);
+        streams.push_back(std::move(stream));
+      }
+    }
+
+    void start(){
+      // The streams are spread over the workers; OpenCV's own threads would only compete with them
+      setNumThreads(opencv_threads);
+      std::cout << "Processing " << streams.size() << " streams on " << num_threads << " worker threads"
+                << (work_stealing ? " with work stealing\n" : "\n");
+      if (work_stealing){
+        pool.reset(new WorkStealingPool(num_threads));
+      }
+      else {
+        pool.reset(new ThreadPool(num_threads));
+      }
+      batcher.reset();
+      if (batching && worker_models[0]->dnn_face_detector.supportsBatching()){
+        std::vector<DnnFaceDetector*> detectors;
+        for (std::unique_ptr<DetectorModels>& models : worker_models){
+          detectors.push_back(&models->dnn_face_detector);
+        }
+        batcher.reset(new DnnBatcher(pool.get(), detectors, max_batch, max_wait));
+        std::cout << "Batching DNN face searches: up to " << max_batch << " frames, waiting at most " << max_wait * 1000.0 << " ms\n";
+      }
+      else if (batching && worker_models[0]->dnn_face_detector.isLoaded()){
+        std::cout << "Only the SSD face model takes batches, running one frame per forward pass\n";
+      }
+      alert_scheduler.start();
+      running = true;
+      for (std::unique_ptr<Stream>& stream : streams){
+        stream->capture_thread = std::thread(&StreamRunner::captureLoop, this, std::ref(*stream));
+      }
+    }
+
+    // Stops capturing and finishes the frames already captured
+    void stop(){
+      if (!pool){
+        return;
+      }
+      running = false;
+      for (std::unique_ptr<Stream>& stream : streams){
+        {
+          std::lock_guard<std::mutex> lock(stream->mutex); // a capture thread between check and wait
+        }
+        stream->slot_free.notify_all();
+        stream->capture_thread.join();
+      }
+      // Frames waiting for a batch still need the pool, so let them finish before stopping it
+      if (batcher){
+        while (!isIdle()){
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        batcher->stop();
+      }
+      pool->stop();
+      alert_scheduler.stop();
+      WorkStealingPool* stealing_pool = dynamic_cast<WorkStealingPool*>(pool.get());
+      num_stolen = stealing_pool != NULL ? stealing_pool->getNumStolen() : 0;
+      pool.reset();
+    }
+
+    // All streams have ended and their last frames are processed
+    bool isFinished(){
+      for (std::unique_ptr<Stream>& stream : streams){
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (!stream->ended){
+          return false;
+        }
+      }
+      return isIdle();
+    }
+
+    // No frame is being processed
+    bool isIdle(){
+      for (std::unique_ptr<Stream>& stream : streams){
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (stream->in_flight || stream->checking){
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // NULL unless the streams' DNN face searches are batched; its statistics stay after stop()
+    DnnBatcher* getBatcher(){
+      return batcher.get();
+    }
+
+    std::vector<std::unique_ptr<Stream>>& getStreams(){
+      return streams;
+    }
+
+    int getNumThreads(){
+      return num_threads;
+    }
+
+    // Tasks run by another worker than the one that queued them, after stop()
+    long getNumStolen(){
+      return num_stolen;
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs tasks on a fixed set of worker threads. A task gets the index of the worker running it, so
+// it can use per-worker resources such as detector models.
+class TaskScheduler {
+  public:
+    virtual ~TaskScheduler(){}
+    virtual int getNumThreads() = 0;
+    virtual void submit(std::function<void(int)> task) = 0;
+    // Runs the queued tasks, including any they submit, then joins the workers
+    virtual void stop() = 0;
+};
+
+// Worker threads taking tasks from one FIFO queue
+class ThreadPool : public TaskScheduler {
+  private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void(int)>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    bool stopping = false;
+
+    void work(int worker){
+      while (true){
+        std::function<void(int)> task;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          task_available.wait(lock, [this]{ return stopping || !tasks.empty(); });
+          if (tasks.empty()){
+            return; // stopping and drained
+          }
+          task = std::move(tasks.front());
+          tasks.pop_front();
+        }
+        task(worker);
+      }
+    }
+
+  public:
+    // num_threads <= 0: one per hardware thread
+    ThreadPool(int num_threads){
+      if (num_threads <= 0){
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      for (int i = 0; i < num_threads; i++){
+        workers.emplace_back(&ThreadPool::work, this, i);
+      }
+    }
+
+    ~ThreadPool(){
+      stop();
+    }
+
+    int getNumThreads() override {
+      return (int)workers.size();
+    }
+
+    void submit(std::function<void(int)> task) override {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+      }
+      task_available.notify_one();
+    }
+
+    void stop() override {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      task_available.notify_all();
+      for (std::thread& worker : workers){
+        worker.join();
+      }
+      workers.clear();
+    }
+};
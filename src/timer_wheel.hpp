@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel (as in the Linux kernel's classic timer implementation). Level 0 has
+// one slot per tick; each higher level covers a whole lap of the level below per slot and is
+// cascaded down when the lower level wraps. Scheduling and cancelling are O(1), advancing is O(1)
+// per tick plus the timers that expire or cascade. Timers are identified by an index below
+// max_timers and are stored in intrusive lists, so nothing is allocated after construction.
+// Not thread-safe: all calls must come from the thread that owns the wheel.
+template <int LEVEL0_BITS = 8, int LEVEL_BITS = 6, int NUM_LEVELS = 3>
+class TimerWheel {
+  private:
+    static constexpr int LEVEL0_SIZE = 1 << LEVEL0_BITS;
+    static constexpr int LEVEL_SIZE = 1 << LEVEL_BITS;
+    static constexpr int NUM_SLOTS = LEVEL0_SIZE + (NUM_LEVELS - 1) * LEVEL_SIZE;
+    static constexpr int NONE = -1;
+
+    struct Node {
+      uint64_t expiry_tick = 0;
+      int prev = NONE;
+      int next = NONE;
+      int slot = NONE; // NONE when not scheduled
+    };
+
+    std::vector<Node> nodes;
+    std::vector<int> slot_heads;
+    uint64_t current_tick = 0;
+
+    // First slot of a level in slot_heads
+    static int levelOffset(int level){
+      return level == 0 ? 0 : LEVEL0_SIZE + (level - 1) * LEVEL_SIZE;
+    }
+
+    static int levelShift(int level){
+      return level == 0 ? 0 : LEVEL0_BITS + (level - 1) * LEVEL_BITS;
+    }
+
+    void link(int id, int slot){
+      Node& node = nodes[id];
+      node.slot = slot;
+      node.prev = NONE;
+      node.next = slot_heads[slot];
+      if (node.next != NONE){
+        nodes[node.next].prev = id;
+      }
+      slot_heads[slot] = id;
+    }
+
+    void unlink(int id){
+      Node& node = nodes[id];
+      if (node.prev != NONE){
+        nodes[node.prev].next = node.next;
+      }
+      else {
+        slot_heads[node.slot] = node.next;
+      }
+      if (node.next != NONE){
+        nodes[node.next].prev = node.prev;
+      }
+      node.slot = NONE;
+    }
+
+    // Picks the level whose range covers the distance to expiry. Overdue timers go to
+    // earliest_tick: the next tick normally, the current one while it is being cascaded.
+    void insert(int id, uint64_t earliest_tick){
+      uint64_t expiry = nodes[id].expiry_tick;
+      if (expiry < earliest_tick){
+        expiry = earliest_tick;
+      }
+      uint64_t delta = expiry - current_tick;
+
+      for (int level = 0; level < NUM_LEVELS; level++){
+        int bits = level == 0 ? LEVEL0_BITS : LEVEL_BITS;
+        uint64_t range = (uint64_t)1 << (levelShift(level) + bits);
+        if (delta < range || level == NUM_LEVELS - 1){
+          if (delta >= range){
+            // Beyond the wheel's horizon: park in the last slot and re-cascade until due
+            expiry = current_tick + range - 1;
+          }
+          int index = (int)((expiry >> levelShift(level)) & (((uint64_t)1 << bits) - 1));
+          link(id, levelOffset(level) + index);
+          return;
+        }
+      }
+    }
+
+    // Moves all timers of one slot of a higher level down to where they now belong
+    int cascade(int level){
+      int index = (int)((current_tick >> levelShift(level)) & (LEVEL_SIZE - 1));
+      int slot = levelOffset(level) + index;
+      int id = slot_heads[slot];
+      slot_heads[slot] = NONE;
+      while (id != NONE){
+        int next = nodes[id].next;
+        nodes[id].slot = NONE;
+        insert(id, current_tick);
+        id = next;
+      }
+      return index;
+    }
+
+  public:
+    TimerWheel(int max_timers) : nodes(max_timers), slot_heads(NUM_SLOTS, NONE) {}
+
+    uint64_t getCurrentTick(){
+      return current_tick;
+    }
+
+    // (Re)schedules a timer to expire at an absolute tick
+    void schedule(int id, uint64_t expiry_tick){
+      if (nodes[id].slot != NONE){
+        unlink(id);
+      }
+      nodes[id].expiry_tick = expiry_tick;
+      insert(id, current_tick + 1);
+    }
+
+    void cancel(int id){
+      if (nodes[id].slot != NONE){
+        unlink(id);
+      }
+    }
+
+    bool isPending(int id){
+      return nodes[id].slot != NONE;
+    }
+
+    // Earliest tick at which advance() has work: the next occupied slot of level 0, else the next
+    // cascade of an occupied slot of a higher level (its timers may expire later than that).
+    // UINT64_MAX if no timer is pending. O(slots), for sleeping until then.
+    uint64_t getNextEventTick(){
+      for (uint64_t tick = current_tick + 1; tick <= current_tick + LEVEL0_SIZE; tick++){
+        if (slot_heads[tick & (LEVEL0_SIZE - 1)] != NONE){
+          return tick;
+        }
+      }
+      uint64_t next = UINT64_MAX;
+      for (int level = 1; level < NUM_LEVELS; level++){
+        int shift = levelShift(level);
+        for (uint64_t lap = 1; lap <= LEVEL_SIZE; lap++){
+          // A level's slot is cascaded when the ticks below it wrap
+          uint64_t tick = ((current_tick >> shift) + lap) << shift;
+          if (slot_heads[levelOffset(level) + (int)((tick >> shift) & (LEVEL_SIZE - 1))] != NONE){
+            next = std::min(next, tick);
+            break;
+          }
+        }
+      }
+      return next;
+    }
+
+    // Advances tick by tick up to to_tick, calling on_expire(id) for every expired timer.
+    // Callbacks may reschedule the timer that just fired, or schedule timers that are not pending.
+    template <typename Callback>
+    void advance(uint64_t to_tick, Callback on_expire){
+      while (current_tick < to_tick){
+        current_tick++;
+
+        int index = (int)(current_tick & (LEVEL0_SIZE - 1));
+        for (int level = 1; index == 0 && level < NUM_LEVELS; level++){
+          index = cascade(level);
+        }
+
+        int slot = (int)(current_tick & (LEVEL0_SIZE - 1));
+        int id = slot_heads[slot];
+        slot_heads[slot] = NONE;
+        while (id != NONE){
+          int next = nodes[id].next;
+          nodes[id].slot = NONE;
+          if (nodes[id].expiry_tick > current_tick){
+            insert(id, current_tick + 1); // parked beyond the horizon, not due yet
+          }
+          else {
+            on_expire(id);
+          }
+          id = next;
+        }
+      }
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include "opencv2/imgproc.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <linux/videodev2.h>
+
+using namespace cv;
+
+// Minimal memory-mapped V4L2 capture. Unlike VideoCapture it exposes its file descriptor, which
+// becomes readable when a frame is ready, so that it can be waited on with epoll.
+class V4l2Capture {
+  private:
+    struct Buffer {
+      void* start = MAP_FAILED;
+      size_t length = 0;
+    };
+
+    int fd = -1;
+    std::vector<Buffer> buffers;
+    int width = 0;
+    int height = 0;
+    int bytes_per_line = 0;
+    bool streaming = false;
+
+    static int xioctl(int fd, unsigned long request, void* arg){
+      int result;
+      do {
+        result = ioctl(fd, request, arg);
+      } while (result == -1 && errno == EINTR);
+      return result;
+    }
+
+    bool fail(const char* what){
+      std::cout << "V4L2 " << what << " failed: " << strerror(errno) << "\n";
+      close();
+      return false;
+    }
+
+  public:
+    ~V4l2Capture(){
+      close();
+    }
+
+    // Opens /dev/video<camera_id> in YUYV at (about) the requested resolution and starts streaming
+    bool open(int camera_id, int requested_width = 640, int requested_height = 480, int num_buffers = 4){
+      std::string device = "/dev/video" + std::to_string(camera_id);
+      fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+      if (fd < 0){
+        return fail("open");
+      }
+
+      v4l2_format format;
+      memset(&format, 0, sizeof(format));
+      format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      format.fmt.pix.width = requested_width;
+      format.fmt.pix.height = requested_height;
+      format.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+      format.fmt.pix.field = V4L2_FIELD_ANY;
+      if (xioctl(fd, VIDIOC_S_FMT, &format) < 0){
+        return fail("VIDIOC_S_FMT");
+      }
+      if (format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV){
+        std::cout << "V4L2 device does not support YUYV\n";
+        close();
+        return false;
+      }
+      // The driver may have picked the nearest supported resolution
+      width = format.fmt.pix.width;
+      height = format.fmt.pix.height;
+      bytes_per_line = format.fmt.pix.bytesperline;
+
+      v4l2_requestbuffers request;
+      memset(&request, 0, sizeof(request));
+      request.count = num_buffers;
+      request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      request.memory = V4L2_MEMORY_MMAP;
+      if (xioctl(fd, VIDIOC_REQBUFS, &request) < 0){
+        return fail("VIDIOC_REQBUFS");
+      }
+
+      buffers.resize(request.count);
+      for (unsigned int i = 0; i < request.count; i++){
+        v4l2_buffer buffer;
+        memset(&buffer, 0, sizeof(buffer));
+        buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buffer.memory = V4L2_MEMORY_MMAP;
+        buffer.index = i;
+        if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) < 0){
+          return fail("VIDIOC_QUERYBUF");
+        }
+
+        buffers[i].length = buffer.length;
+        buffers[i].start = mmap(NULL, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffer.m.offset);
+        if (buffers[i].start == MAP_FAILED){
+          return fail("mmap");
+        }
+        if (xioctl(fd, VIDIOC_QBUF, &buffer) < 0){
+          return fail("VIDIOC_QBUF");
+        }
+      }
+
+      v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      if (xioctl(fd, VIDIOC_STREAMON, &type) < 0){
+        return fail("VIDIOC_STREAMON");
+      }
+      streaming = true;
+      return true;
+    }
+
+    void close(){
+      if (streaming){
+        v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        xioctl(fd, VIDIOC_STREAMOFF, &type);
+        streaming = false;
+      }
+      for (Buffer& buffer : buffers){
+        if (buffer.start != MAP_FAILED){
+          munmap(buffer.start, buffer.length);
+        }
+      }
+      buffers.clear();
+      if (fd >= 0){
+        ::close(fd);
+        fd = -1;
+      }
+    }
+
+    int getFd(){
+      return fd;
+    }
+
+    // Call when the fd is readable. Converts the dequeued frame to BGR into frame, reusing its
+    // allocation, and hands the buffer straight back to the driver. Returns false if no frame was ready.
+    bool readFrame(Mat& frame){
+      v4l2_buffer buffer;
+      memset(&buffer, 0, sizeof(buffer));
+      buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+      buffer.memory = V4L2_MEMORY_MMAP;
+      if (xioctl(fd, VIDIOC_DQBUF, &buffer) < 0){
+        if (errno != EAGAIN){
+          std::cout << "V4L2 VIDIOC_DQBUF failed: " << strerror(errno) << "\n";
+        }
+        return false;
+      }
+
+      Mat yuyv(height, width, CV_8UC2, buffers[buffer.index].start, bytes_per_line);
+      cvtColor(yuyv, frame, COLOR_YUV2BGR_YUYV);
+
+      xioctl(fd, VIDIOC_QBUF, &buffer);
+      return true;
+    }
+};
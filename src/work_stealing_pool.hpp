@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+// Worker threads with a deque each. A worker pushes the tasks it submits (a frame's next step) to
+// the back of its own deque and pops from the back, so follow-up work runs on the core that has
+// its data in cache; tasks from outside are dealt round-robin. A worker whose deque is empty steals
+// the oldest task from the front of another's, so a few expensive face searches queued on one
+// worker do not hold up cheap tracked frames while other workers idle. The deques are short (a few
+// tasks per stream), so each has a plain mutex, and idle workers sleep instead of spinning.
+class WorkStealingPool : public TaskScheduler {
+  private:
+    struct alignas(64) WorkerQueue {
+      std::mutex mutex;
+      std::deque<std::function<void(int)>> tasks;
+    };
+
+    std::unique_ptr<WorkerQueue[]> queues;
+    std::vector<std::thread> workers;
+    int num_workers = 0;
+    std::atomic<long> num_queued{0};
+    std::atomic<long> num_stolen{0};
+    std::atomic<unsigned> next_queue{0};
+
+    std::mutex sleep_mutex;
+    std::condition_variable task_available;
+    std::atomic<int> num_sleeping{0};
+    bool stopping = false;
+
+    // Worker index of the calling thread in this pool, -1 outside of it
+    int currentWorker(){
+      return current_pool() == this ? current_index() : -1;
+    }
+
+    static const WorkStealingPool*& current_pool(){
+      static thread_local const WorkStealingPool* pool = NULL;
+      return pool;
+    }
+
+    static int& current_index(){
+      static thread_local int index = -1;
+      return index;
+    }
+
+    bool popOwn(int worker, std::function<void(int)>& task){
+      WorkerQueue& queue = queues[worker];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()){
+        return false;
+      }
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      return true;
+    }
+
+    bool steal(int worker, std::function<void(int)>& task){
+      for (int i = 1; i < num_workers; i++){
+        WorkerQueue& victim = queues[(worker + i) % num_workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()){
+          task = std::move(victim.tasks.front());
+          victim.tasks.pop_front();
+          num_stolen++;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void work(int worker){
+      current_pool() = this;
+      current_index() = worker;
+      while (true){
+        std::function<void(int)> task;
+        if (popOwn(worker, task) || steal(worker, task)){
+          num_queued--;
+          task(worker);
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        if (stopping && num_queued == 0){
+          return; // stopping and drained
+        }
+        // A submit() after this increment sees it and wakes us; one before it is seen in num_queued
+        num_sleeping++;
+        task_available.wait(lock, [this]{ return stopping || num_queued > 0; });
+        num_sleeping--;
+      }
+    }
+
+  public:
+    // num_threads <= 0: one per hardware thread
+    WorkStealingPool(int num_threads){
+      if (num_threads <= 0){
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+      }
+      num_workers = num_threads;
+      queues.reset(new WorkerQueue[num_workers]);
+      for (int i = 0; i < num_workers; i++){
+        workers.emplace_back(&WorkStealingPool::work, this, i);
+      }
+    }
+
+    ~WorkStealingPool(){
+      stop();
+    }
+
+    int getNumThreads() override {
+      return num_workers;
+    }
+
+    void submit(std::function<void(int)> task) override {
+      int worker = currentWorker();
+      WorkerQueue& queue = queues[worker >= 0 ? worker : next_queue++ % num_workers];
+      {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+      }
+      num_queued++;
+      if (num_sleeping > 0){
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        task_available.notify_one();
+      }
+    }
+
+    void stop() override {
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+      }
+      task_available.notify_all();
+      for (std::thread& worker : workers){
+        worker.join();
+      }
+      workers.clear();
+    }
+
+    // Tasks taken from another worker's deque
+    long getNumStolen(){
+      return num_stolen;
+    }
+};
@@ -0,0 +1,56 @@
+#include <vector>
+
+#include "alert_scheduler.hpp"
+#include "check.hpp"
+
+// Levels: 10 s between beeps down to a countdown of -30 s, 5 s down to -60 s, 1 s below that
+void testBeepLevel(){
+  CHECK(AlertScheduler::getBeepLevel(0.0) == 0);
+  CHECK(AlertScheduler::getBeepLevel(-30.0) == 0);
+  CHECK(AlertScheduler::getBeepLevel(-30.001) == 1);
+  CHECK(AlertScheduler::getBeepLevel(-60.0) == 1);
+  CHECK(AlertScheduler::getBeepLevel(-60.001) == 2);
+  CHECK(AlertScheduler::getBeepLevel(-1000.0) == 2);
+  CHECK(AlertScheduler::getBeepPeriod(-10.0) == 10.0);
+  CHECK(AlertScheduler::getBeepPeriod(-45.0) == 5.0);
+  CHECK(AlertScheduler::getBeepPeriod(-90.0) == 1.0);
+}
+
+// A period that would run past the next level's start is cut short at the boundary
+void testSecondsUntilNextBeep(){
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(0.0), 10.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-20.0), 10.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-25.0), 5.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-28.0), 5.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-30.0), 5.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-55.0), 5.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-58.0), 2.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-60.0), 1.0, 1e-9);
+  CHECK_NEAR(AlertScheduler::getSecondsUntilNextBeep(-500.0), 1.0, 1e-9);
+}
+
+// Beeping from the deadline on hits both level boundaries exactly
+void testBeepSequence(){
+  std::vector<double> expected = { 0, -10, -20, -30, -35, -40, -45, -50, -55, -60, -61, -62 };
+  double countdown = 0.0;
+  for (double beep : expected){
+    CHECK_NEAR(countdown, beep, 1e-9);
+    countdown -= AlertScheduler::getSecondsUntilNextBeep(countdown);
+  }
+
+  // Starting late (the posture went bad while nobody was checking), the beeps never come closer
+  // together than the period of the level they are heading into
+  std::vector<double> late = { -27, -32, -37 };
+  countdown = -27.0;
+  for (double beep : late){
+    CHECK_NEAR(countdown, beep, 1e-9);
+    countdown -= AlertScheduler::getSecondsUntilNextBeep(countdown);
+  }
+}
+
+int main(){
+  testBeepLevel();
+  testSecondsUntilNextBeep();
+  testBeepSequence();
+  return 0;
+}
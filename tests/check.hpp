@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+// Minimal assertions for the unit tests: a failed check prints where it failed and ends the test
+// with a non-zero exit code, which ctest reports
+#define CHECK(condition) \
+  do { \
+    if (!(condition)){ \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+      std::exit(1); \
+    } \
+  } while (0)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+  do { \
+    double value_ = (value), expected_ = (expected); \
+    if (!(std::abs(value_ - expected_) <= (tolerance))){ \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK_NEAR(" #value ", " #expected ") failed: " \
+                << value_ << " vs " << expected_ << "\n"; \
+      std::exit(1); \
+    } \
+  } while (0)
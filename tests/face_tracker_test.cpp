@@ -0,0 +1,100 @@
+#include <vector>
+
+#include "face_tracker.hpp"
+#include "check.hpp"
+
+static int trackId(FaceTracker& tracker, int face_index){
+  for (const FaceTracker::Track& track : tracker.getTracks()){
+    if (track.face_index == face_index){
+      return track.id;
+    }
+  }
+  return -1;
+}
+
+// Faces keep their IDs while they overlap their track, whatever order the detector returns them in
+void testMatching(){
+  FaceTracker tracker;
+  std::vector<Rect> faces = { Rect(100, 100, 100, 100), Rect(400, 120, 60, 60) };
+  tracker.update(faces);
+  CHECK(tracker.getTracks().size() == 2);
+  int user = trackId(tracker, 0), other = trackId(tracker, 1);
+  CHECK(user != other);
+
+  faces = { Rect(410, 125, 60, 60), Rect(110, 105, 100, 100) };
+  tracker.update(faces);
+  CHECK(tracker.getTracks().size() == 2);
+  CHECK(trackId(tracker, 0) == other);
+  CHECK(trackId(tracker, 1) == user);
+
+  // Too little overlap (IoU below 0.3) is a different face
+  faces = { Rect(170, 105, 100, 100) };
+  tracker.update(faces);
+  CHECK(trackId(tracker, 0) != user);
+  CHECK(trackId(tracker, 0) != other);
+  CHECK(tracker.getTracks().size() == 3);
+}
+
+// A track continues with the face it overlaps most; the other face starts a track of its own
+void testBestOverlap(){
+  FaceTracker tracker;
+  std::vector<Rect> faces = { Rect(0, 0, 100, 100) };
+  tracker.update(faces);
+  int user = trackId(tracker, 0);
+  faces = { Rect(40, 0, 100, 100), Rect(10, 0, 100, 100) }; // IoU 0.43 and 0.82
+  tracker.update(faces);
+  CHECK(trackId(tracker, 1) == user);
+  CHECK(trackId(tracker, 0) != user && trackId(tracker, 0) >= 0);
+}
+
+// The user stays primary when a larger face appears, and is waited for while briefly missed
+void testPrimary(){
+  FaceTracker tracker;
+  std::vector<Rect> faces = { Rect(100, 100, 100, 100) };
+  tracker.update(faces);
+  CHECK(tracker.selectPrimary(faces) == 0);
+  int user = tracker.getPrimaryId();
+
+  faces = { Rect(300, 100, 120, 120), Rect(102, 100, 100, 100) };
+  tracker.update(faces);
+  CHECK(tracker.selectPrimary(faces) == 1);
+  CHECK(tracker.getPrimaryId() == user);
+
+  // Missed for max_misses detections: no face is picked
+  faces = { Rect(300, 100, 120, 120) };
+  for (int i = 0; i < 5; i++){
+    tracker.update(faces);
+    CHECK(tracker.selectPrimary(faces) == -1);
+  }
+  // Then the track ends and the other face takes over
+  tracker.update(faces);
+  CHECK(tracker.selectPrimary(faces) == 0);
+  CHECK(tracker.getPrimaryId() != user);
+}
+
+// A box moved along with the face while detection was off still matches when it resumes
+void testFollowPrimary(){
+  FaceTracker tracker;
+  std::vector<Rect> faces = { Rect(100, 100, 100, 100) };
+  tracker.update(faces);
+  tracker.selectPrimary(faces);
+  int user = tracker.getPrimaryId();
+  tracker.followPrimary(Point(350, 150));
+
+  faces = { Rect(300, 100, 100, 100) };
+  tracker.update(faces);
+  CHECK(tracker.selectPrimary(faces) == 0);
+  CHECK(tracker.getPrimaryId() == user);
+
+  tracker.reset();
+  CHECK(tracker.getTracks().empty());
+  CHECK(tracker.getPrimaryId() == -1);
+}
+
+int main(){
+  testMatching();
+  testBestOverlap();
+  testPrimary();
+  testFollowPrimary();
+  return 0;
+}
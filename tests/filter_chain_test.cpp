@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <random>
+
+#include "filter_chain.hpp"
+#include "check.hpp"
+
+// Every lane is sorted independently, the same as std::sort per lane, duplicates included
+template <int N>
+void testSortLanes(std::mt19937& random){
+  std::uniform_int_distribution<int> value(-3, 3);
+  for (int run = 0; run < 1000; run++){
+    Lanes values[N];
+    double expected[4][N];
+    for (int i = 0; i < N; i++){
+      for (int lane = 0; lane < 4; lane++){
+        values[i].v[lane] = expected[lane][i] = value(random) * 0.5;
+      }
+    }
+    sortLanes(values);
+    for (int lane = 0; lane < 4; lane++){
+      std::sort(expected[lane], expected[lane] + N);
+      for (int i = 0; i < N; i++){
+        CHECK(values[i].v[lane] == expected[lane][i]);
+      }
+    }
+  }
+}
+
+void testMedianLanes(){
+  Lanes values[5] = { { { 5, -1, 0.3, 9 } }, { { 1, -2, 0.1, 9 } }, { { 4, -5, 0.2, 9 } },
+                      { { 2, -3, 0.5, 9 } }, { { 3, -4, 0.4, 9 } } };
+  Lanes median = medianLanes(values);
+  CHECK(median.v[0] == 3);
+  CHECK(median.v[1] == -3);
+  CHECK(median.v[2] == 0.3);
+  CHECK(median.v[3] == 9);
+}
+
+// Clean samples pass unchanged; a jump on any single axis is replaced by the window's median
+void testHampel(std::mt19937& random){
+  HampelStage<7> hampel;
+  std::normal_distribution<double> noise(0.0, 0.01);
+  FilterTime now = FilterTime::clock::now();
+  Position last;
+  for (int i = 0; i < 7; i++){
+    last = { 0.1 + noise(random), -0.05 + noise(random), 0.6 + noise(random) };
+    Position out = hampel.process(last, now);
+    CHECK(out == last);
+  }
+
+  Position spike = last;
+  spike[2] += 0.5;
+  Position out = hampel.process(spike, now);
+  CHECK(hampel.getRejectedCount() == 1);
+  CHECK(out != spike);
+  CHECK_NEAR(out[2], 0.6, 0.03);
+
+  // The spike stays in the window, but one outlier among seven does not move the median far
+  Position clean = { 0.1, -0.05, 0.6 };
+  CHECK(hampel.process(clean, now) == clean);
+  CHECK(hampel.getRejectedCount() == 1);
+
+  // A real move is followed once it holds for more than half the window
+  Position moved = { 0.3, -0.05, 0.6 };
+  int rejected = 0;
+  for (int i = 0; i < 7; i++){
+    rejected += hampel.process(moved, now) != moved;
+  }
+  CHECK(rejected > 0 && rejected <= 3);
+  CHECK(hampel.process(moved, now) == moved);
+}
+
+void testMedianStage(){
+  MedianStage<5> median;
+  FilterTime now = FilterTime::clock::now();
+  for (int i = 0; i < 4; i++){
+    median.process({ 0.0, 0.0, 0.5 }, now);
+  }
+  Position out = median.process({ 1.0, 0.0, 0.5 }, now);
+  CHECK(out[0] == 0.0);
+  Position position, uncertainty;
+  CHECK(median.predict(now, position, uncertainty));
+  CHECK(position == out);
+}
+
+// Outliers never reach the later stages of a chain
+void testChain(){
+  MovingAverageChain chain;
+  chain.readSettings(json::object());
+  FilterTime now = FilterTime::clock::now();
+  Position position, uncertainty;
+  CHECK(!chain.predict(now, position, uncertainty));
+  for (int i = 0; i < 10; i++){
+    chain.process({ 0.0, 0.0, 0.5 + (i % 2) * 0.002 }, now);
+  }
+  Position out = chain.process({ 0.0, 0.0, 3.0 }, now);
+  CHECK_NEAR(out[2], 0.501, 0.001);
+  CHECK(chain.getRejectedCount() == 1);
+}
+
+void testSelectableChain(){
+  SelectableFilterChain chain;
+  chain.readSettings(json::object());
+  CHECK(chain.getName() == "kalman");
+  CHECK(!chain.select("unknown"));
+  CHECK(chain.getName() == "kalman");
+  CHECK(chain.select("median_ema"));
+  chain.readSettings(json::object());
+
+  FilterTime now = FilterTime::clock::now();
+  Position position, uncertainty;
+  chain.process({ 0.1, 0.2, 0.5 }, now);
+  CHECK(chain.predict(now, position, uncertainty));
+  CHECK(chain.select("median_ema"));
+  CHECK(chain.predict(now, position, uncertainty));
+
+  // Same chain, no history
+  chain.reset();
+  CHECK(chain.getName() == "median_ema");
+  CHECK(!chain.predict(now, position, uncertainty));
+}
+
+int main(){
+  std::mt19937 random(7);
+  testSortLanes<3>(random);
+  testSortLanes<5>(random);
+  testSortLanes<7>(random);
+  testSortLanes<8>(random);
+  testMedianLanes();
+  testHampel(random);
+  testMedianStage();
+  testChain();
+  testSelectableChain();
+  return 0;
+}
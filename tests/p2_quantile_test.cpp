@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "p2_quantile.hpp"
+#include "check.hpp"
+
+static double exactQuantile(std::vector<double> samples, double p){
+  std::sort(samples.begin(), samples.end());
+  return samples[(size_t)(p * (samples.size() - 1) + 0.5)];
+}
+
+// Below five samples the estimate is the exact quantile of what was added
+void testFewSamples(){
+  P2Quantile median(0.5);
+  CHECK(median.get() == 0.0);
+  median.add(3.0);
+  CHECK(median.get() == 3.0);
+  median.add(1.0);
+  median.add(2.0);
+  CHECK(median.getCount() == 3);
+  CHECK(median.get() == 2.0);
+
+  P2Quantile high(0.9);
+  for (double x : { 4.0, 1.0, 3.0, 2.0 }){
+    high.add(x);
+  }
+  CHECK(high.get() == 4.0);
+
+  median.reset();
+  CHECK(median.getCount() == 0);
+  median.add(7.0);
+  CHECK(median.get() == 7.0);
+}
+
+void testConstant(){
+  P2Quantile quantile(0.99);
+  for (int i = 0; i < 1000; i++){
+    quantile.add(0.25);
+  }
+  CHECK(quantile.get() == 0.25);
+}
+
+// On long streams the estimate lands close to the exact quantile, in rank as well as in value
+template <typename Distribution>
+void testStream(Distribution distribution, double p, double rank_tolerance){
+  std::mt19937 random(11);
+  std::vector<double> samples;
+  P2Quantile quantile(p);
+  for (int i = 0; i < 100000; i++){
+    double x = distribution(random);
+    samples.push_back(x);
+    quantile.add(x);
+  }
+  CHECK(quantile.getCount() == (long)samples.size());
+  double estimate = quantile.get();
+  double rank = std::count_if(samples.begin(), samples.end(), [&](double x){ return x < estimate; }) / (double)samples.size();
+  CHECK_NEAR(rank, p, rank_tolerance);
+  CHECK_NEAR(estimate, exactQuantile(samples, p), 0.05);
+}
+
+// Sorted input, the worst case for the markers, still ends near the true quantile
+void testSortedInput(){
+  P2Quantile median(0.5);
+  for (int i = 0; i < 10001; i++){
+    median.add(i);
+  }
+  CHECK_NEAR(median.get(), 5000.0, 100.0);
+}
+
+int main(){
+  testFewSamples();
+  testConstant();
+  testStream(std::uniform_real_distribution<double>(0.0, 1.0), 0.5, 0.01);
+  testStream(std::normal_distribution<double>(0.0, 0.1), 0.1, 0.01);
+  testStream(std::normal_distribution<double>(0.0, 0.1), 0.9, 0.01);
+  testStream(std::exponential_distribution<double>(50.0), 0.99, 0.002);
+  testSortedInput();
+  return 0;
+}
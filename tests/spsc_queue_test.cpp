@@ -0,0 +1,136 @@
+#include <chrono>
+#include <thread>
+
+#include "spsc_queue.hpp"
+#include "check.hpp"
+
+// Items come out in order; an empty queue does not pop
+void testFifo(){
+  SpscQueue<int> queue(4, OverflowPolicy::BLOCK);
+  int item;
+  CHECK(!queue.tryPop(item));
+  for (int i = 1; i <= 4; i++){
+    CHECK(queue.push(int(i)));
+  }
+  for (int i = 1; i <= 4; i++){
+    CHECK(queue.tryPop(item));
+    CHECK(item == i);
+  }
+  CHECK(!queue.tryPop(item));
+  CHECK(queue.getDroppedCount() == 0);
+}
+
+// A full queue discards its oldest items, so the newest capacity items remain
+void testDropOldest(){
+  SpscQueue<int> queue(3, OverflowPolicy::DROP_OLDEST);
+  for (int i = 1; i <= 5; i++){
+    CHECK(queue.push(int(i)));
+  }
+  CHECK(queue.getDroppedCount() == 2);
+  int item;
+  for (int i = 3; i <= 5; i++){
+    CHECK(queue.tryPop(item));
+    CHECK(item == i);
+  }
+  CHECK(!queue.tryPop(item));
+
+  // Wraps around the ring several times
+  for (int i = 6; i <= 20; i++){
+    CHECK(queue.push(int(i)));
+  }
+  CHECK(queue.getDroppedCount() == 14);
+  for (int i = 18; i <= 20; i++){
+    CHECK(queue.tryPop(item));
+    CHECK(item == i);
+  }
+}
+
+// After close(), pop() drains what is left and then fails; a producer blocked on a full queue gives up
+void testClose(){
+  SpscQueue<int> queue(2, OverflowPolicy::BLOCK);
+  CHECK(queue.push(1));
+  CHECK(queue.push(2));
+  std::thread producer([&]{ CHECK(!queue.push(3)); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  queue.close();
+  producer.join();
+
+  int item;
+  CHECK(queue.pop(item) && item == 1);
+  CHECK(queue.pop(item) && item == 2);
+  CHECK(!queue.pop(item));
+}
+
+// A consumer asleep on an empty queue is woken by the next push and by close()
+void testWakeUp(){
+  SpscQueue<int> queue(2, OverflowPolicy::BLOCK);
+  int received = 0;
+  std::thread consumer([&]{
+    int item;
+    while (queue.pop(item)){
+      received += item;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  CHECK(queue.push(5));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  queue.close();
+  consumer.join();
+  CHECK(received == 5);
+}
+
+// With BLOCK, every item arrives once and in order while both sides keep waiting on each other
+void testThreadedBlock(){
+  const int num_items = 200000;
+  SpscQueue<int> queue(4, OverflowPolicy::BLOCK);
+  bool in_order = true;
+  int count = 0;
+  std::thread consumer([&]{
+    int item;
+    while (queue.pop(item)){
+      in_order &= item == count;
+      count++;
+    }
+  });
+  for (int i = 0; i < num_items; i++){
+    CHECK(queue.push(int(i)));
+  }
+  queue.close();
+  consumer.join();
+  CHECK(in_order);
+  CHECK(count == num_items);
+}
+
+// With DROP_OLDEST, what arrives is increasing and every item is either delivered or counted as dropped
+void testThreadedDropOldest(){
+  const int num_items = 200000;
+  SpscQueue<int> queue(4, OverflowPolicy::DROP_OLDEST);
+  bool increasing = true;
+  long count = 0;
+  std::thread consumer([&]{
+    int item;
+    int last = -1;
+    while (queue.pop(item)){
+      increasing &= item > last;
+      last = item;
+      count++;
+    }
+  });
+  for (int i = 0; i < num_items; i++){
+    CHECK(queue.push(int(i)));
+  }
+  queue.close();
+  consumer.join();
+  CHECK(increasing);
+  CHECK(count + queue.getDroppedCount() == num_items);
+}
+
+int main(){
+  testFifo();
+  testDropOldest();
+  testClose();
+  testWakeUp();
+  testThreadedBlock();
+  testThreadedDropOldest();
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "timer_wheel.hpp"
+#include "check.hpp"
+
+// Level 0 covers 256 ticks, level 1 256 * 64 and level 2 256 * 64 * 64
+static const uint64_t LEVEL1_START = 256;
+static const uint64_t LEVEL2_START = 256 * 64;
+static const uint64_t HORIZON = 256 * 64 * 64;
+
+// Advances to to_tick and records the tick at which each timer fired
+void advance(TimerWheel<>& wheel, uint64_t to_tick, std::vector<uint64_t>& fired_at){
+  wheel.advance(to_tick, [&](int id){
+    CHECK(fired_at[id] == 0);
+    fired_at[id] = wheel.getCurrentTick();
+  });
+}
+
+void testLevel0(){
+  TimerWheel<> wheel(1);
+  std::vector<uint64_t> fired_at(1, 0);
+  CHECK(wheel.getNextEventTick() == UINT64_MAX);
+  wheel.schedule(0, 5);
+  CHECK(wheel.isPending(0));
+  CHECK(wheel.getNextEventTick() == 5);
+  advance(wheel, 4, fired_at);
+  CHECK(fired_at[0] == 0);
+  advance(wheel, 10, fired_at);
+  CHECK(fired_at[0] == 5);
+  CHECK(!wheel.isPending(0));
+  CHECK(wheel.getNextEventTick() == UINT64_MAX);
+}
+
+// Timers on the higher levels and beyond the horizon are cascaded down and fire on their exact tick
+void testCascade(){
+  std::vector<uint64_t> expiries = { LEVEL1_START - 1, LEVEL1_START, LEVEL1_START + 44, LEVEL2_START - 1,
+                                     LEVEL2_START, LEVEL2_START + 300, HORIZON - 1, HORIZON, HORIZON + 1000 };
+  TimerWheel<> wheel((int)expiries.size());
+  std::vector<uint64_t> fired_at(expiries.size(), 0);
+  for (int id = 0; id < (int)expiries.size(); id++){
+    wheel.schedule(id, expiries[id]);
+  }
+  // The first event of a timer on level 1 is the cascade of its slot
+  CHECK(wheel.getNextEventTick() == LEVEL1_START - 1);
+
+  // In uneven steps, so that some steps cross several cascades
+  for (uint64_t tick = 0; tick < HORIZON + 2000; tick += 997){
+    advance(wheel, tick, fired_at);
+  }
+  for (int id = 0; id < (int)expiries.size(); id++){
+    CHECK(fired_at[id] == expiries[id]);
+  }
+}
+
+void testCancel(){
+  TimerWheel<> wheel(3);
+  std::vector<uint64_t> fired_at(3, 0);
+  wheel.schedule(0, 10);
+  wheel.schedule(1, LEVEL1_START + 10);
+  wheel.schedule(2, LEVEL2_START + 10);
+  wheel.cancel(1);
+  wheel.cancel(2);
+  CHECK(!wheel.isPending(1));
+  CHECK(!wheel.isPending(2));
+  advance(wheel, 20, fired_at);
+  CHECK(fired_at[0] == 10);
+
+  // A timer cancelled after it was cascaded down does not fire either
+  wheel.schedule(1, LEVEL1_START + 10);
+  advance(wheel, LEVEL1_START + 5, fired_at);
+  CHECK(wheel.isPending(1));
+  wheel.cancel(1);
+  advance(wheel, HORIZON, fired_at);
+  CHECK(fired_at[1] == 0);
+  CHECK(fired_at[2] == 0);
+  CHECK(wheel.getNextEventTick() == UINT64_MAX);
+}
+
+// Rescheduling replaces the old expiry; an overdue expiry fires on the next tick
+void testReschedule(){
+  TimerWheel<> wheel(2);
+  std::vector<uint64_t> fired_at(2, 0);
+  wheel.schedule(0, LEVEL2_START + 1);
+  wheel.schedule(0, 7);
+  advance(wheel, 100, fired_at);
+  wheel.schedule(1, 50);
+  advance(wheel, LEVEL2_START + 10, fired_at);
+  CHECK(fired_at[0] == 7);
+  CHECK(fired_at[1] == 101);
+}
+
+// A callback can reschedule the timer that just fired
+void testPeriodic(){
+  TimerWheel<> wheel(1);
+  std::vector<uint64_t> fired;
+  wheel.schedule(0, 300);
+  wheel.advance(3000, [&](int id){
+    fired.push_back(wheel.getCurrentTick());
+    wheel.schedule(id, wheel.getCurrentTick() + 300);
+  });
+  CHECK(fired.size() == 10);
+  for (int i = 0; i < (int)fired.size(); i++){
+    CHECK(fired[i] == (uint64_t)(i + 1) * 300);
+  }
+}
+
+// Many timers with random expiries, some cancelled, each fires exactly once on its tick
+void testRandom(){
+  const int num_timers = 2000;
+  std::mt19937_64 random(42);
+  std::uniform_int_distribution<uint64_t> expiry(1, 2 * HORIZON);
+  TimerWheel<> wheel(num_timers);
+  std::vector<uint64_t> expected(num_timers), fired_at(num_timers, 0);
+  for (int id = 0; id < num_timers; id++){
+    expected[id] = expiry(random);
+    wheel.schedule(id, expected[id]);
+  }
+  for (int id = 0; id < num_timers; id += 7){
+    wheel.cancel(id);
+    expected[id] = 0;
+  }
+  // Steps from event to event, as the alert scheduler does
+  uint64_t tick;
+  while ((tick = wheel.getNextEventTick()) != UINT64_MAX){
+    advance(wheel, tick, fired_at);
+  }
+  for (int id = 0; id < num_timers; id++){
+    CHECK(fired_at[id] == expected[id]);
+  }
+}
+
+int main(){
+  testLevel0();
+  testCascade();
+  testCancel();
+  testReschedule();
+  testPeriodic();
+  testRandom();
+  return 0;
+}